@@ -0,0 +1,417 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "adaptive.h"
+#include "snapshot.h"
+
+#define UNSEEN_WEIGHT 1.5 // keys never typed are worth practising
+#define ERROR_WEIGHT 4.0  // how much a miss counts against a key
+#define MIN_DIGRAPH_COUNT 3
+#define MIN_WEIGHT 0.25
+#define MAX_WEIGHT 4.0
+#define WEIGHT_EPSILON 1e-9
+
+static int feature_of_key(char key) {
+    if (key < 'a' || key > 'z')
+        return -1;
+    return key - 'a';
+}
+
+static int feature_of_digraph(char prev_key, char key) {
+    int p = prev_key == ' ' ? ADAPTIVE_SPACE : feature_of_key(prev_key);
+    int k = feature_of_key(key);
+    if (p < 0 || k < 0)
+        return -1;
+    return ADAPTIVE_KEYS + p * ADAPTIVE_KEYS + k;
+}
+
+// The aggregate cell of digraph p, k in feature order
+static const agg_cell *digraph_cell(const aggregate *agg, int p, int k) {
+    char prev_key = p == ADAPTIVE_SPACE ? ' ' : 'a' + p;
+    return &agg->digraph[aggregate_key_index(prev_key)]
+                        [aggregate_key_index('a' + k)];
+}
+
+// Store the features of a word in out, which must hold 2 * len entries
+// A word starts after a space, which is its first digraph
+static int word_features(const char *word, int len, uint16_t *out) {
+    int n = 0;
+    for (int i = 0; i < len; i++) {
+        int f = feature_of_key(word[i]);
+        if (f >= 0)
+            out[n++] = f;
+        f = feature_of_digraph(i > 0 ? word[i - 1] : ' ', word[i]);
+        if (f >= 0)
+            out[n++] = f;
+    }
+    return n;
+}
+
+int adaptive_init(adaptive_sampler *a, const word_corpus *words) {
+    memset(a, 0, sizeof(*a));
+    a->num_words = words->count;
+    size_t n = a->num_words;
+
+    size_t max_len = 0;
+    for (size_t w = 0; w < n; w++) {
+        if (words->refs[w].len > max_len)
+            max_len = words->refs[w].len;
+    }
+    uint16_t *scratch = malloc(sizeof(uint16_t) * (2 * max_len + 1));
+    if (!scratch) {
+        perror("malloc failed");
+        return -1;
+    }
+
+    // Count features to size every table exactly
+    size_t total = 0;
+    size_t feature_count[ADAPTIVE_NUM_FEATURES] = {0};
+    for (size_t w = 0; w < n; w++) {
+        int len;
+        const char *word = corpus_word(words, w, &len);
+        int nf = word_features(word, len, scratch);
+        for (int i = 0; i < nf; i++)
+            feature_count[scratch[i]]++;
+        total += nf;
+    }
+    free(scratch);
+    if (total > UINT32_MAX) {
+        fprintf(stderr, "Corpus too large for adaptive mode\n");
+        return -1;
+    }
+
+    a->word_start = malloc(sizeof(uint32_t) * (n + 1));
+    a->features = malloc(sizeof(uint16_t) * (total ? total : 1));
+    a->feature_start = malloc(sizeof(uint32_t) * (ADAPTIVE_NUM_FEATURES + 1));
+    a->feature_words = malloc(sizeof(uint32_t) * (total ? total : 1));
+    a->word_sum = calloc(n ? n : 1, sizeof(double));
+    a->prob = malloc(sizeof(double) * (n ? n : 1));
+    a->alias = malloc(sizeof(uint32_t) * (n ? n : 1));
+    if (!a->word_start || !a->features || !a->feature_start ||
+        !a->feature_words || !a->word_sum || !a->prob || !a->alias) {
+        perror("malloc failed");
+        adaptive_free(a);
+        return -1;
+    }
+
+    uint32_t pos = 0;
+    for (int f = 0; f < ADAPTIVE_NUM_FEATURES; f++) {
+        a->feature_start[f] = pos;
+        pos += feature_count[f];
+        feature_count[f] = a->feature_start[f]; // next free slot
+    }
+    a->feature_start[ADAPTIVE_NUM_FEATURES] = pos;
+
+    pos = 0;
+    for (size_t w = 0; w < n; w++) {
+        int len;
+        const char *word = corpus_word(words, w, &len);
+        a->word_start[w] = pos;
+        int nf = word_features(word, len, &a->features[pos]);
+        for (int i = 0; i < nf; i++)
+            a->feature_words[feature_count[a->features[pos + i]]++] = w;
+        pos += nf;
+    }
+    a->word_start[n] = pos;
+
+    return 0;
+}
+
+static double clamp_weight(double w) {
+    if (w < MIN_WEIGHT)
+        return MIN_WEIGHT;
+    if (w > MAX_WEIGHT)
+        return MAX_WEIGHT;
+    return w;
+}
+
+// Slower than average and error-prone keys and digraphs weigh more than 1
+static void compute_feature_weights(const stats *s, const aggregate *agg,
+                                    double *weight) {
+    int total_pressed = 0;
+    double total_time = 0.0;
+    for (int k = 0; k < NUM_KEYS; k++) {
+        total_pressed += s->per_key[k].pressed;
+        total_time += s->per_key[k].time_spent;
+    }
+    double mean_time = total_pressed ? total_time / total_pressed : 0.0;
+
+    for (int k = 0; k < ADAPTIVE_KEYS; k++) {
+        int index = key_index('a' + k);
+        const key_stats *ks = &s->per_key[index];
+        if (ks->pressed == 0 || mean_time <= 0.0) {
+            weight[k] = UNSEEN_WEIGHT;
+            continue;
+        }
+        double slowness = ks->time_spent / ks->pressed / mean_time;
+        double error_rate = 1.0 - (double)ks->correct / ks->pressed;
+        weight[k] = clamp_weight(slowness * (1.0 + ERROR_WEIGHT * error_rate));
+    }
+
+    uint64_t total_count = 0;
+    double total_wpm = 0.0;
+    if (agg) {
+        for (int p = 0; p < ADAPTIVE_PREV_KEYS; p++) {
+            for (int k = 0; k < ADAPTIVE_KEYS; k++) {
+                total_count += digraph_cell(agg, p, k)->count;
+                total_wpm += digraph_cell(agg, p, k)->wpm_sum;
+            }
+        }
+    }
+    double mean_wpm = total_count ? total_wpm / total_count : 0.0;
+
+    for (int p = 0; p < ADAPTIVE_PREV_KEYS; p++) {
+        for (int k = 0; k < ADAPTIVE_KEYS; k++) {
+            int f = ADAPTIVE_KEYS + p * ADAPTIVE_KEYS + k;
+            weight[f] = 1.0;
+            if (!agg || mean_wpm <= 0.0)
+                continue;
+            const agg_cell *c = digraph_cell(agg, p, k);
+            if (c->count < MIN_DIGRAPH_COUNT || c->wpm_sum <= 0.0)
+                continue;
+            double slowness = mean_wpm / (c->wpm_sum / c->count);
+            double error_rate = 1.0 - (double)c->correct / c->count;
+            weight[f] =
+                clamp_weight(slowness * (1.0 + ERROR_WEIGHT * error_rate));
+        }
+    }
+}
+
+// Vose's alias method, so picking a word is constant time
+static int build_alias_table(adaptive_sampler *a) {
+    size_t n = a->num_words;
+    if (n == 0)
+        return 0;
+
+    uint32_t *work = malloc(sizeof(uint32_t) * n);
+    if (!work) {
+        perror("malloc failed");
+        return -1;
+    }
+
+    double total = 0.0;
+    for (size_t w = 0; w < n; w++) {
+        uint32_t nf = a->word_start[w + 1] - a->word_start[w];
+        double mean = nf ? a->word_sum[w] / nf : 1.0;
+        a->prob[w] = mean * mean * mean; // sharpen the preference
+        total += a->prob[w];
+    }
+
+    // Small entries are stacked from the front, large ones from the back
+    size_t num_small = 0;
+    size_t large_start = n;
+    for (size_t w = 0; w < n; w++) {
+        a->prob[w] = total > 0.0 ? a->prob[w] * n / total : 1.0;
+        a->alias[w] = w;
+        if (a->prob[w] < 1.0)
+            work[num_small++] = w;
+        else
+            work[--large_start] = w;
+    }
+
+    while (num_small > 0 && large_start < n) {
+        uint32_t small = work[--num_small];
+        uint32_t large = work[large_start];
+        a->alias[small] = large;
+        a->prob[large] += a->prob[small] - 1.0;
+        if (a->prob[large] < 1.0) {
+            large_start++;
+            work[num_small++] = large;
+        }
+    }
+    // Whatever is left is 1 up to rounding
+    while (num_small > 0)
+        a->prob[work[--num_small]] = 1.0;
+    while (large_start < n)
+        a->prob[work[large_start++]] = 1.0;
+
+    free(work);
+    return 0;
+}
+
+int adaptive_update(adaptive_sampler *a, const stats *s, const aggregate *agg) {
+    double weight[ADAPTIVE_NUM_FEATURES];
+    compute_feature_weights(s, agg, weight);
+
+    int changed = 0;
+    for (int f = 0; f < ADAPTIVE_NUM_FEATURES; f++) {
+        double delta = weight[f] - a->feature_weight[f];
+        if (delta < WEIGHT_EPSILON && delta > -WEIGHT_EPSILON)
+            continue;
+        for (uint32_t i = a->feature_start[f]; i < a->feature_start[f + 1];
+             i++)
+            a->word_sum[a->feature_words[i]] += delta;
+        a->feature_weight[f] = weight[f];
+        changed = 1;
+    }
+
+    return changed ? build_alias_table(a) : 0;
+}
+
+static size_t saved_size(size_t num_words, size_t num_features) {
+    return sizeof(adaptive_header) +
+           sizeof(double) * (ADAPTIVE_NUM_FEATURES + 2 * num_words) +
+           sizeof(uint32_t) *
+               (2 * num_words + 1 + ADAPTIVE_NUM_FEATURES + 1 + num_features) +
+           sizeof(uint16_t) * num_features;
+}
+
+static void fill_header(adaptive_header *h, const adaptive_sampler *a,
+                        const struct stat *words_st,
+                        const word_filter *filter) {
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, ADAPTIVE_MAGIC, sizeof(h->magic));
+    h->version = ADAPTIVE_VERSION;
+    h->words_size = words_st->st_size;
+    h->words_mtime_sec = words_st->st_mtim.tv_sec;
+    h->words_mtime_nsec = words_st->st_mtim.tv_nsec;
+    h->include = filter->include;
+    h->only = filter->only;
+    h->min_len = filter->min_len;
+    h->max_len = filter->max_len;
+    h->num_words = a->num_words;
+    h->num_features = a->word_start ? a->word_start[a->num_words] : 0;
+    h->snapshot_checksum = a->snapshot_checksum;
+}
+
+// Whether a saved sampler was built from the same words
+static int same_words(const adaptive_header *h, const adaptive_header *want) {
+    return memcmp(h->magic, ADAPTIVE_MAGIC, sizeof(h->magic)) == 0 &&
+           h->version == ADAPTIVE_VERSION &&
+           h->words_size == want->words_size &&
+           h->words_mtime_sec == want->words_mtime_sec &&
+           h->words_mtime_nsec == want->words_mtime_nsec &&
+           memcmp(&h->include, &want->include, sizeof(key_mask)) == 0 &&
+           memcmp(&h->only, &want->only, sizeof(key_mask)) == 0 &&
+           h->min_len == want->min_len && h->max_len == want->max_len &&
+           h->num_words == want->num_words;
+}
+
+// Map the saved sampler if it was built from these words, privately so that
+// updating it only copies the pages it touches
+// Returns 1 if loaded, 0 if not
+static int load_saved(adaptive_sampler *a, const char *filename,
+                      const adaptive_header *want) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return 0;
+
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(adaptive_header))
+        data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+                    0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return 0;
+
+    const adaptive_header *h = data;
+    if (!same_words(h, want) ||
+        (size_t)st.st_size != saved_size(h->num_words, h->num_features)) {
+        munmap(data, st.st_size);
+        return 0;
+    }
+
+    size_t n = h->num_words;
+    size_t nf = h->num_features;
+    double *d = (double *)((adaptive_header *)data + 1);
+    memcpy(a->feature_weight, d, sizeof(a->feature_weight));
+    a->word_sum = d + ADAPTIVE_NUM_FEATURES;
+    a->prob = a->word_sum + n;
+    a->word_start = (uint32_t *)(a->prob + n);
+    a->feature_start = a->word_start + n + 1;
+    a->feature_words = a->feature_start + ADAPTIVE_NUM_FEATURES + 1;
+    a->alias = a->feature_words + nf;
+    a->features = (uint16_t *)(a->alias + n);
+    a->num_words = n;
+    a->snapshot_checksum = h->snapshot_checksum;
+    a->map = data;
+    a->map_size = st.st_size;
+    return 1;
+}
+
+// Best effort, a missing file only costs the next game a rebuild
+static void save(const adaptive_sampler *a, const char *filename,
+                 const adaptive_header *h) {
+    char tmp_filename[512];
+    snprintf(tmp_filename, sizeof(tmp_filename), "%s.tmp", filename);
+
+    FILE *f = fopen(tmp_filename, "wb");
+    if (!f)
+        return;
+
+    size_t n = a->num_words;
+    size_t nf = h->num_features;
+    int ok =
+        fwrite(h, sizeof(*h), 1, f) == 1 &&
+        fwrite(a->feature_weight, sizeof(a->feature_weight), 1, f) == 1 &&
+        fwrite(a->word_sum, sizeof(double), n, f) == n &&
+        fwrite(a->prob, sizeof(double), n, f) == n &&
+        fwrite(a->word_start, sizeof(uint32_t), n + 1, f) == n + 1 &&
+        fwrite(a->feature_start, sizeof(uint32_t), ADAPTIVE_NUM_FEATURES + 1,
+               f) == ADAPTIVE_NUM_FEATURES + 1 &&
+        fwrite(a->feature_words, sizeof(uint32_t), nf, f) == nf &&
+        fwrite(a->alias, sizeof(uint32_t), n, f) == n &&
+        fwrite(a->features, sizeof(uint16_t), nf, f) == nf;
+    if (fclose(f) != 0)
+        ok = 0;
+    if (!ok || rename(tmp_filename, filename) != 0)
+        remove(tmp_filename);
+}
+
+int adaptive_open(adaptive_sampler *a, const char *filename,
+                  const word_corpus *words, const struct stat *words_st,
+                  const word_filter *filter, const stats *s,
+                  const aggregate *agg) {
+    static snapshot_file snap;
+    snapshot_encode(&snap, s);
+    uint32_t checksum = snap.header.checksum;
+
+    adaptive_header want;
+    memset(a, 0, sizeof(*a));
+    a->num_words = words->count;
+    fill_header(&want, a, words_st, filter);
+
+    if (load_saved(a, filename, &want)) {
+        if (a->snapshot_checksum == checksum)
+            return 0;
+    } else if (adaptive_init(a, words) != 0) {
+        return -1;
+    }
+
+    if (adaptive_update(a, s, agg) != 0) {
+        adaptive_free(a);
+        return -1;
+    }
+    a->snapshot_checksum = checksum;
+    fill_header(&want, a, words_st, filter);
+    save(a, filename, &want);
+    return 0;
+}
+
+size_t adaptive_sample(const adaptive_sampler *a) {
+    size_t w = rand() % a->num_words;
+    int r = rand();
+    double u = r / ((double)RAND_MAX + 1.0);
+    return u < a->prob[w] ? w : a->alias[w];
+}
+
+void adaptive_free(adaptive_sampler *a) {
+    if (a->map) {
+        munmap(a->map, a->map_size);
+        memset(a, 0, sizeof(*a));
+        return;
+    }
+    free(a->word_start);
+    free(a->features);
+    free(a->feature_start);
+    free(a->feature_words);
+    free(a->word_sum);
+    free(a->prob);
+    free(a->alias);
+    memset(a, 0, sizeof(*a));
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "aggregate.h"
+#include "parse_words.h"
+#include "stats.h"
+
+// Features are the keys a-z followed by the digraphs [prevKey][key], where
+// prevKey is a-z or space
+#define ADAPTIVE_KEYS 26
+#define ADAPTIVE_PREV_KEYS 27
+#define ADAPTIVE_SPACE 26 // index of space as previous key
+#define ADAPTIVE_NUM_FEATURES                                                  \
+    (ADAPTIVE_KEYS + ADAPTIVE_PREV_KEYS * ADAPTIVE_KEYS)
+
+// Saved sampler, stats/<player>.adaptive.bin (native byte order):
+//
+//   header        "NTAS" + uint32 version, the size and mtime of the words
+//                 file, the filter its words passed, the number of words and
+//                 word features, and the checksum of the player snapshot the
+//                 weights were computed from
+//   double        feature_weight[ADAPTIVE_NUM_FEATURES], word_sum[num_words],
+//                 prob[num_words]
+//   uint32        word_start[num_words + 1],
+//                 feature_start[ADAPTIVE_NUM_FEATURES + 1],
+//                 feature_words[num_features], alias[num_words]
+//   uint16        features[num_features]
+//
+// It is reused while the words file and filter match, so the features of the
+// corpus are not extracted again. With the same snapshot the alias table is
+// used as is; the aggregate is saved along with the snapshot, so its
+// checksum stands for both.
+
+#define ADAPTIVE_MAGIC "NTAS"
+#define ADAPTIVE_VERSION 1
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t words_size;
+    int64_t words_mtime_sec;
+    int64_t words_mtime_nsec;
+    key_mask include;
+    key_mask only;
+    uint16_t min_len;
+    uint16_t max_len;
+    uint32_t num_words;
+    uint32_t num_features;
+    uint32_t snapshot_checksum;
+} adaptive_header;
+
+// Picks words in proportion to how much they exercise the player's slow and
+// inaccurate keys and digraphs
+typedef struct {
+    size_t num_words;
+
+    // Features of each word, word i owns features[word_start[i]..[i + 1])
+    uint32_t *word_start;
+    uint16_t *features;
+
+    // Words of each feature, the inverse of the above
+    uint32_t *feature_start;
+    uint32_t *feature_words;
+
+    double feature_weight[ADAPTIVE_NUM_FEATURES];
+    double *word_sum; // sum of feature weights per word
+
+    // Alias table over the word weights
+    double *prob;
+    uint32_t *alias;
+
+    uint32_t snapshot_checksum; // of the stats the weights came from
+    void *map;                  // saved sampler, NULL if built in memory
+    size_t map_size;
+} adaptive_sampler;
+
+// Extract the features of every word in the corpus
+// Returns 0 on success, -1 on failure
+int adaptive_init(adaptive_sampler *a, const word_corpus *words);
+
+// Recompute the word weights from the player's stats, only touching words
+// whose features changed weight, and rebuild the alias table if any did
+// agg may be NULL if there is no digraph data
+// Returns 0 on success, -1 on failure
+int adaptive_update(adaptive_sampler *a, const stats *s, const aggregate *agg);
+
+// Set up the sampler for words, which passed filter, from the one saved in
+// filename if it was built from the same words, then update it for the
+// player's stats and save it for the next game
+// Returns 0 on success, -1 on failure
+int adaptive_open(adaptive_sampler *a, const char *filename,
+                  const word_corpus *words, const struct stat *words_st,
+                  const word_filter *filter, const stats *s,
+                  const aggregate *agg);
+
+// Draw a word index in constant time
+size_t adaptive_sample(const adaptive_sampler *a);
+
+void adaptive_free(adaptive_sampler *a);
@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "aggregate.h"
+
+void aggregate_init(aggregate *a) { memset(a, 0, sizeof(*a)); }
+
+// Same as key_index, which lives with the game's stats code
+int aggregate_key_index(char key) {
+    if (key < FIRST_KEY || key >= FIRST_KEY + NUM_KEYS)
+        return -1;
+    return key - FIRST_KEY;
+}
+
+char aggregate_key_char(int index) { return FIRST_KEY + index; }
+
+int aggregate_trigram_index(char key) {
+    if (key < 'a' || key > 'z')
+        return -1;
+    return key - 'a';
+}
+
+char aggregate_trigram_char(int index) { return 'a' + index; }
+
+static void add_to_cell(agg_cell *c, double wpm, int correct) {
+    c->count++;
+    c->correct += correct ? 1 : 0;
+    c->wpm_sum += wpm;
+}
+
+void aggregate_add_row(aggregate *a, char key, char prev_key, double wpm,
+                       int correct) {
+    // Rows without a previous key are left out, as in show_stats.py
+    if (prev_key == '\0')
+        return;
+
+    int k = aggregate_key_index(key);
+    if (k < 0)
+        return;
+    add_to_cell(&a->per_key[k], wpm, correct);
+
+    int p = aggregate_key_index(prev_key);
+    if (p >= 0)
+        add_to_cell(&a->digraph[p][k], wpm, correct);
+
+    // The trigram is the previous row's prevKey, this row's prevKey and key
+    int t2 = aggregate_trigram_index(a->last_prev_key);
+    int t1 = aggregate_trigram_index(prev_key);
+    int t0 = aggregate_trigram_index(key);
+    if (t2 >= 0 && t1 >= 0 && t0 >= 0)
+        add_to_cell(&a->trigram[t2][t1][t0], wpm, correct);
+    a->last_prev_key = prev_key;
+}
+
+void aggregate_add_block(aggregate *a, const history_block *b) {
+    for (uint32_t i = 0; i < b->num_rows; i++)
+        aggregate_add_row(a, b->key[i], b->prev_key[i], b->wpm[i], b->acc[i]);
+}
+
+void aggregate_add_stats(aggregate *a, const stats *s) {
+    for (int i = 0; i < NUM_KEYS; i++) {
+        const key_stats *k = &s->per_key[i];
+        for (const key_press_block *b = k->history; b; b = b->next) {
+            for (int j = 0; j < b->len; j++)
+                aggregate_add_row(a, k->key, b->presses[j].prev_key,
+                                  b->presses[j].wpm, b->presses[j].correct);
+        }
+    }
+}
+
+static void merge_cell(agg_cell *dest, const agg_cell *src) {
+    dest->count += src->count;
+    dest->correct += src->correct;
+    dest->wpm_sum += src->wpm_sum;
+}
+
+void aggregate_merge(aggregate *dest, const aggregate *src) {
+    for (int k = 0; k < AGG_KEYS; k++)
+        merge_cell(&dest->per_key[k], &src->per_key[k]);
+    for (int p = 0; p < AGG_KEYS; p++) {
+        for (int k = 0; k < AGG_KEYS; k++)
+            merge_cell(&dest->digraph[p][k], &src->digraph[p][k]);
+    }
+    for (int i = 0; i < AGG_TRIGRAM_KEYS; i++) {
+        for (int j = 0; j < AGG_TRIGRAM_KEYS; j++) {
+            for (int k = 0; k < AGG_TRIGRAM_KEYS; k++)
+                merge_cell(&dest->trigram[i][j][k], &src->trigram[i][j][k]);
+        }
+    }
+}
+
+long aggregate_rebuild(const char *history_filename, aggregate *a) {
+    aggregate_init(a);
+
+    history_reader reader;
+    if (history_reader_open(history_filename, &reader) != 0)
+        return -1;
+
+    long num_rows = 0;
+    history_block b;
+    int r;
+    while ((r = history_reader_next(&reader, &b)) == 1) {
+        aggregate_add_block(a, &b);
+        num_rows += b.num_rows;
+    }
+    history_reader_close(&reader);
+
+    if (r < 0) {
+        fprintf(stderr, "%s: corrupt key history\n", history_filename);
+        return -1;
+    }
+    return num_rows;
+}
+
+int aggregate_load(const char *filename, aggregate *a, uint64_t *num_rows) {
+    FILE *f = fopen(filename, "rb");
+    if (!f)
+        return 0;
+
+    aggregate_file_header h;
+    int ok = fread(&h, sizeof(h), 1, f) == 1 &&
+             memcmp(h.magic, AGGREGATE_MAGIC, sizeof(h.magic)) == 0 &&
+             h.version == AGGREGATE_VERSION && fread(a, sizeof(*a), 1, f) == 1;
+    fclose(f);
+
+    if (!ok) {
+        fprintf(stderr, "%s: ignoring invalid aggregate snapshot\n", filename);
+        return 0;
+    }
+    *num_rows = h.num_rows;
+    return 1;
+}
+
+int aggregate_save(const char *filename, const aggregate *a,
+                   uint64_t num_rows) {
+    char tmp_filename[512];
+    snprintf(tmp_filename, sizeof(tmp_filename), "%s.tmp", filename);
+
+    FILE *f = fopen(tmp_filename, "wb");
+    if (!f) {
+        perror("fopen");
+        return -1;
+    }
+
+    aggregate_file_header h;
+    memcpy(h.magic, AGGREGATE_MAGIC, sizeof(h.magic));
+    h.version = AGGREGATE_VERSION;
+    h.num_rows = num_rows;
+
+    int ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+             fwrite(a, sizeof(*a), 1, f) == 1;
+    if (fclose(f) != 0)
+        ok = 0;
+    if (!ok || rename(tmp_filename, filename) != 0) {
+        perror("Could not save aggregate snapshot");
+        remove(tmp_filename);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <stdint.h>
+
+#include "history.h"
+
+#define AGG_KEYS NUM_KEYS   // every printable key, indexed like stats
+#define AGG_TRIGRAM_KEYS 26 // a-z
+
+#define AGGREGATE_MAGIC "NTAG"
+#define AGGREGATE_VERSION 2
+
+// Snapshot file: this header followed by the aggregate struct
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t num_rows; // history rows folded into the snapshot
+} aggregate_file_header;
+
+// Presses, summed wpm and correct presses for one key, digraph or trigram
+typedef struct {
+    uint64_t count;
+    uint64_t correct;
+    double wpm_sum;
+} agg_cell;
+
+// Fixed-size accumulators over key history rows that have a previous key
+typedef struct aggregate {
+    agg_cell per_key[AGG_KEYS];
+    agg_cell digraph[AGG_KEYS][AGG_KEYS]; // [prevKey][key]
+    agg_cell trigram[AGG_TRIGRAM_KEYS][AGG_TRIGRAM_KEYS][AGG_TRIGRAM_KEYS];
+    char last_prev_key; // prevKey of the last row, starts the next trigram
+} aggregate;
+
+void aggregate_init(aggregate *a);
+
+void aggregate_add_row(aggregate *a, char key, char prev_key, double wpm,
+                       int correct);
+
+void aggregate_add_block(aggregate *a, const history_block *b);
+
+// Add the keystrokes of one game, in the order they are saved to history
+void aggregate_add_stats(aggregate *a, const stats *s);
+
+// Add the counters of src to dest
+void aggregate_merge(aggregate *dest, const aggregate *src);
+
+// Build the aggregate from a whole key history file
+// Returns number of rows read, -1 on failure
+long aggregate_rebuild(const char *history_filename, aggregate *a);
+
+// Returns 1 if the snapshot was loaded, 0 otherwise
+int aggregate_load(const char *filename, aggregate *a, uint64_t *num_rows);
+
+// Write the snapshot to a temporary file and rename it into place
+// Returns 0 on success, -1 on failure
+int aggregate_save(const char *filename, const aggregate *a,
+                   uint64_t num_rows);
+
+// Index of a key in per_key and digraph, -1 if it is not tracked
+int aggregate_key_index(char key);
+
+char aggregate_key_char(int index);
+
+// Index of a letter in trigram, -1 for any other key
+int aggregate_trigram_index(char key);
+
+char aggregate_trigram_char(int index);
@@ -0,0 +1,75 @@
+#include <stdalign.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "arena.h"
+
+struct arena_chunk {
+    arena_chunk *next;
+    size_t size; // bytes in data
+    size_t used;
+    max_align_t data[];
+};
+
+static size_t align_up(size_t n) {
+    size_t align = alignof(max_align_t);
+    return (n + align - 1) & ~(align - 1);
+}
+
+void arena_init(arena *a) {
+    a->chunks = NULL;
+    a->num_allocs = 0;
+    a->num_chunks = 0;
+    a->bytes_used = 0;
+    a->bytes_reserved = 0;
+}
+
+void *arena_alloc(arena *a, size_t size) {
+    size = align_up(size ? size : 1);
+
+    arena_chunk *c = a->chunks;
+    if (!c || c->size - c->used < size) {
+        // Larger allocations get a chunk of their own
+        size_t chunk_size = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+        c = calloc(1, sizeof(arena_chunk) + chunk_size);
+        if (!c) {
+            perror("calloc failed");
+            return NULL;
+        }
+        c->size = chunk_size;
+        c->used = 0;
+        if (size > ARENA_CHUNK_SIZE && a->chunks) {
+            // Keep allocating from the room left in the newest chunk
+            c->next = a->chunks->next;
+            a->chunks->next = c;
+        } else {
+            c->next = a->chunks;
+            a->chunks = c;
+        }
+        a->num_chunks++;
+        a->bytes_reserved += chunk_size;
+    }
+
+    void *p = (char *)c->data + c->used;
+    c->used += size;
+    a->num_allocs++;
+    a->bytes_used += size;
+    return p;
+}
+
+void arena_free(arena *a) {
+    arena_chunk *c = a->chunks;
+    while (c) {
+        arena_chunk *next = c->next;
+        free(c);
+        c = next;
+    }
+    arena_init(a);
+}
+
+void arena_print_stats(const arena *a, const char *name) {
+    printf("%s arena: %zu allocations in %zu chunks, %zu of %zu bytes used\n",
+           name, a->num_allocs, a->num_chunks, a->bytes_used,
+           a->bytes_reserved);
+}
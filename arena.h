@@ -0,0 +1,30 @@
+#pragma once
+#include <stddef.h>
+
+// Bump allocator for memory that lives exactly as long as one game or one
+// word corpus. Allocations are carved out of large zeroed chunks and can't
+// be freed one by one, arena_free() releases all of them at once.
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+typedef struct arena_chunk arena_chunk;
+
+typedef struct arena {
+    arena_chunk *chunks; // newest first, allocations come from the newest
+
+    // Counters for --alloc-stats
+    size_t num_allocs;
+    size_t num_chunks; // chunks taken from malloc
+    size_t bytes_used;
+    size_t bytes_reserved;
+} arena;
+
+void arena_init(arena *a);
+
+// Returns zeroed memory aligned for any type, NULL on failure
+void *arena_alloc(arena *a, size_t size);
+
+void arena_free(arena *a);
+
+// Print the counters of the arena under a name
+void arena_print_stats(const arena *a, const char *name);
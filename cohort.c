@@ -0,0 +1,229 @@
+#include <dirent.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cohort.h"
+
+#define HISTORY_SUFFIX ".key-history.bin"
+#define MIN_CHUNK_SIZE (1 << 20)
+#define CHUNKS_PER_THREAD 4 // smaller chunks even out uneven threads
+
+// A run of whole blocks of one history file
+typedef struct {
+    int file;
+    size_t start;
+    size_t end;
+    char last_prev_key; // of the row before start, carries the trigram on
+} chunk;
+
+typedef struct {
+    history_map map;
+    char filename[512];
+} history_file;
+
+typedef struct {
+    history_file *files;
+    int num_files;
+    size_t chunk_size;
+
+    chunk *chunks;
+    int num_chunks;
+    int chunks_cap;
+    pthread_mutex_t chunks_lock; // only taken while splitting
+
+    int next_file;  // taken with atomic increments
+    int next_chunk; // taken with atomic increments
+    int failed;
+} cohort;
+
+typedef struct {
+    cohort *c;
+    aggregate agg;
+    long num_rows;
+} worker;
+
+static int add_chunk(cohort *c, const chunk *ch) {
+    pthread_mutex_lock(&c->chunks_lock);
+    int ret = 0;
+    if (c->num_chunks == c->chunks_cap) {
+        int cap = c->chunks_cap ? c->chunks_cap * 2 : 64;
+        chunk *chunks = realloc(c->chunks, sizeof(chunk) * cap);
+        if (chunks) {
+            c->chunks = chunks;
+            c->chunks_cap = cap;
+        } else {
+            perror("realloc failed");
+            ret = -1;
+        }
+    }
+    if (ret == 0)
+        c->chunks[c->num_chunks++] = *ch;
+    pthread_mutex_unlock(&c->chunks_lock);
+    return ret;
+}
+
+// Walk the block headers of a file and cut it into chunks
+static int split_file(cohort *c, int file) {
+    const history_map *m = &c->files[file].map;
+    chunk ch = {file, sizeof(history_file_header), 0, '\0'};
+    size_t offset = ch.start;
+    history_block b;
+    int r;
+    while ((r = history_next_block(m, &offset, &b)) == 1) {
+        if (offset - ch.start < c->chunk_size)
+            continue;
+        ch.end = offset;
+        if (add_chunk(c, &ch) != 0)
+            return -1;
+        ch.start = offset;
+        ch.last_prev_key = b.num_rows ? b.prev_key[b.num_rows - 1] : '\0';
+    }
+    if (r < 0) {
+        fprintf(stderr, "%s: corrupt block at offset %zu\n",
+                c->files[file].filename, offset);
+        return -1;
+    }
+    ch.end = offset;
+    if (ch.end > ch.start && add_chunk(c, &ch) != 0)
+        return -1;
+    return 0;
+}
+
+static void *split_files(void *arg) {
+    worker *w = arg;
+    cohort *c = w->c;
+    int file;
+    while ((file = __atomic_fetch_add(&c->next_file, 1, __ATOMIC_RELAXED)) <
+           c->num_files) {
+        if (c->files[file].map.data && split_file(c, file) != 0)
+            __atomic_store_n(&c->failed, 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+static void *aggregate_chunks(void *arg) {
+    worker *w = arg;
+    cohort *c = w->c;
+    int i;
+    while ((i = __atomic_fetch_add(&c->next_chunk, 1, __ATOMIC_RELAXED)) <
+           c->num_chunks) {
+        const chunk *ch = &c->chunks[i];
+        history_map range = {c->files[ch->file].map.data, ch->end};
+        size_t offset = ch->start;
+        history_block b;
+        w->agg.last_prev_key = ch->last_prev_key;
+        while (history_next_block(&range, &offset, &b) == 1) {
+            aggregate_add_block(&w->agg, &b);
+            w->num_rows += b.num_rows;
+        }
+    }
+    return NULL;
+}
+
+// Run fn on every worker, the calling thread being the first one
+// Work is taken from shared counters, so threads that fail to start only
+// leave more of it to the others
+static void run_pool(worker *workers, int n, void *(*fn)(void *)) {
+    pthread_t *threads = malloc(sizeof(pthread_t) * n);
+    int started = 1;
+    while (threads && started < n &&
+           pthread_create(&threads[started], NULL, fn, &workers[started]) ==
+               0)
+        started++;
+    fn(&workers[0]);
+    for (int i = 1; i < started; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+}
+
+// Map every key history in the directory
+// Returns number of files, -1 on failure
+static int open_histories(const char *dir, history_file **files) {
+    DIR *d = opendir(dir);
+    if (!d) {
+        perror(dir);
+        return -1;
+    }
+
+    int n = 0;
+    int cap = 0;
+    *files = NULL;
+    size_t suffix_len = strlen(HISTORY_SUFFIX);
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        size_t len = strlen(e->d_name);
+        if (len <= suffix_len ||
+            strcmp(e->d_name + len - suffix_len, HISTORY_SUFFIX) != 0)
+            continue;
+        if (n == cap) {
+            cap = cap ? cap * 2 : 16;
+            history_file *f = realloc(*files, sizeof(history_file) * cap);
+            if (!f) {
+                perror("realloc failed");
+                break;
+            }
+            *files = f;
+        }
+
+        history_file *f = &(*files)[n];
+        snprintf(f->filename, sizeof(f->filename), "%s/%s", dir, e->d_name);
+        if (history_open(f->filename, &f->map) == 0)
+            n++;
+    }
+    closedir(d);
+    return n;
+}
+
+long cohort_aggregate(const char *dir, int num_threads, aggregate *a,
+                      int *num_players) {
+    aggregate_init(a);
+    if (num_threads < 1)
+        num_threads = 1;
+
+    cohort c;
+    memset(&c, 0, sizeof(c));
+    c.num_files = open_histories(dir, &c.files);
+    if (c.num_files < 0)
+        return -1;
+    *num_players = c.num_files;
+
+    size_t total = 0;
+    for (int i = 0; i < c.num_files; i++)
+        total += c.files[i].map.size;
+    c.chunk_size = total / ((size_t)num_threads * CHUNKS_PER_THREAD);
+    if (c.chunk_size < MIN_CHUNK_SIZE)
+        c.chunk_size = MIN_CHUNK_SIZE;
+
+    worker *workers = calloc(num_threads, sizeof(worker));
+    if (!workers) {
+        perror("calloc failed");
+        for (int i = 0; i < c.num_files; i++)
+            history_close(&c.files[i].map);
+        free(c.files);
+        return -1;
+    }
+    for (int i = 0; i < num_threads; i++)
+        workers[i].c = &c;
+    pthread_mutex_init(&c.chunks_lock, NULL);
+
+    // All files are split before any chunk is read, so one big file is
+    // spread over every thread
+    run_pool(workers, num_threads, split_files);
+    run_pool(workers, num_threads, aggregate_chunks);
+
+    long num_rows = 0;
+    for (int i = 0; i < num_threads; i++) {
+        aggregate_merge(a, &workers[i].agg);
+        num_rows += workers[i].num_rows;
+    }
+
+    pthread_mutex_destroy(&c.chunks_lock);
+    for (int i = 0; i < c.num_files; i++)
+        history_close(&c.files[i].map);
+    free(c.files);
+    free(c.chunks);
+    free(workers);
+    return c.failed ? -1 : num_rows;
+}
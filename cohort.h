@@ -0,0 +1,12 @@
+#pragma once
+#include "aggregate.h"
+
+// Aggregate the key history of every player in a stats directory on a pool
+// of num_threads threads. Histories are cut at block boundaries into chunks
+// of about the same size, each thread folds the chunks it takes into its own
+// aggregate and the aggregates are merged at the end. The counts are exactly
+// those of scanning the files one after another, the wpm sums only differ in
+// rounding.
+// Returns number of rows read, -1 on failure
+long cohort_aggregate(const char *dir, int num_threads, aggregate *a,
+                      int *num_players);
@@ -0,0 +1,87 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "daemon.h"
+
+#define DAEMON_TIMEOUT_SEC 5 // give up and fall back to the files
+
+static int transfer(int fd, void *buf, size_t size, int sending) {
+    char *p = buf;
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = sending ? send(fd, p + done, size - done, MSG_NOSIGNAL)
+                            : recv(fd, p + done, size - done, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        done += n;
+    }
+    return 0;
+}
+
+static int call(const daemon_request *req, stats *s) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", DAEMON_SOCKET);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd); // no daemon, not an error
+        return -1;
+    }
+
+    struct timeval timeout = {DAEMON_TIMEOUT_SEC, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    daemon_reply reply;
+    int ok = transfer(fd, (void *)req, sizeof(*req), 1) == 0 &&
+             transfer(fd, &reply, sizeof(reply), 0) == 0;
+    close(fd);
+
+    if (ok && reply.magic == DAEMON_MAGIC && reply.status != 0) {
+        fprintf(stderr, "neotapd could not save, using the stats files\n");
+        return -1;
+    }
+    if (!ok || reply.magic != DAEMON_MAGIC ||
+        snapshot_decode(&reply.player, s) != 0) {
+        fprintf(stderr, "neotapd did not answer, using the stats files\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int init_request(daemon_request *req, uint32_t type,
+                        const char *player_name) {
+    memset(req, 0, sizeof(*req));
+    if (strlen(player_name) >= sizeof(req->player))
+        return -1;
+    req->magic = DAEMON_MAGIC;
+    req->type = type;
+    strcpy(req->player, player_name);
+    return 0;
+}
+
+int daemon_get_stats(const char *player_name, stats *s) {
+    daemon_request req;
+    if (init_request(&req, DAEMON_GET_STATS, player_name) != 0)
+        return -1;
+    return call(&req, s);
+}
+
+int daemon_add_game(const char *player_name, const stats *game, stats *s) {
+    daemon_request req;
+    if (init_request(&req, DAEMON_ADD_GAME, player_name) != 0)
+        return -1;
+    snapshot_encode(&req.game, game);
+    return call(&req, s);
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <stdint.h>
+
+#include "snapshot.h"
+#include "stats.h"
+
+// Protocol between neotap and neotapd over a Unix domain socket. Every
+// connection carries one fixed-size request and one fixed-size reply, in
+// native byte order since both ends run on the same host.
+
+#define DAEMON_SOCKET "stats/neotapd.sock"
+#define DAEMON_MAGIC 0x4454544e // "NTTD"
+#define DAEMON_PLAYER_MAX 64
+
+enum {
+    DAEMON_GET_STATS = 1, // the player's totals
+    DAEMON_ADD_GAME = 2,  // merge a game into the player's totals
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t type;
+    char player[DAEMON_PLAYER_MAX]; // null-terminated
+    snapshot_file game;             // only used by DAEMON_ADD_GAME
+} daemon_request;
+
+typedef struct {
+    uint32_t magic;
+    int32_t status; // 0 on success, -1 on failure
+    snapshot_file player; // totals, including the game if one was added
+} daemon_reply;
+
+// The client side returns 0 on success and -1 if there is no daemon or it
+// failed, in which case the caller should use the stats files directly
+
+// Fill the counters of s with the player's totals
+int daemon_get_stats(const char *player_name, stats *s);
+
+// Add the game to the player's totals and fill the counters of s with the
+// new totals; the daemon replies once they are on disk, or with a failure
+// if it could not write them
+int daemon_add_game(const char *player_name, const stats *game, stats *s);
@@ -0,0 +1,179 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "events.h"
+
+static size_t align8(size_t n) { return (n + 7) & ~(size_t)7; }
+
+static size_t block_size(uint32_t text_len, uint32_t num_events) {
+    return sizeof(events_block_header) + align8(text_len) +
+           sizeof(key_event) * num_events;
+}
+
+void event_log_init(event_log *log) {
+    log->events = NULL;
+    log->len = 0;
+    log->cap = 0;
+    log->arena = NULL;
+}
+
+int event_log_push(event_log *log, int64_t t_ns, uint32_t pos, char key,
+                   char target) {
+    if (log->len >= log->cap) {
+        uint32_t cap = log->cap ? log->cap * 2 : 256;
+        key_event *events;
+        if (log->arena) {
+            // The old events stay in the arena until the game is over
+            events = arena_alloc(log->arena, sizeof(key_event) * cap);
+            if (events && log->len)
+                memcpy(events, log->events, sizeof(key_event) * log->len);
+        } else {
+            events = realloc(log->events, sizeof(key_event) * cap);
+            if (!events)
+                perror("realloc failed");
+        }
+        if (!events)
+            return -1;
+        log->events = events;
+        log->cap = cap;
+    }
+    key_event *e = &log->events[log->len++];
+    e->t_ns = t_ns;
+    e->pos = pos;
+    e->key = key;
+    e->target = target;
+    e->pad = 0;
+    return 0;
+}
+
+void event_log_free(event_log *log) {
+    if (!log->arena)
+        free(log->events);
+    event_log_init(log);
+}
+
+int events_append_game(const char *filename, int64_t date, uint32_t seed,
+                       const char *text, const event_log *log) {
+    uint32_t text_len = strlen(text);
+    size_t size = block_size(text_len, log->len);
+    unsigned char *block = calloc(1, size);
+    if (!block) {
+        perror("calloc failed");
+        return -1;
+    }
+
+    events_block_header h = {EVENTS_BLOCK_MAGIC, log->len, date, seed,
+                             text_len};
+    unsigned char *p = block;
+    memcpy(p, &h, sizeof(h));
+    p += sizeof(h);
+    memcpy(p, text, text_len);
+    p += align8(text_len);
+    memcpy(p, log->events, sizeof(key_event) * log->len);
+
+    int ret = -1;
+    FILE *f = fopen(filename, "ab");
+    if (!f) {
+        perror("fopen");
+    } else {
+        ret = 0;
+        if (ftell(f) == 0) {
+            events_file_header fh;
+            memcpy(fh.magic, EVENTS_MAGIC, sizeof(fh.magic));
+            fh.version = EVENTS_VERSION;
+            if (fwrite(&fh, sizeof(fh), 1, f) != 1)
+                ret = -1;
+        }
+        if (ret == 0 && fwrite(block, size, 1, f) != 1)
+            ret = -1;
+        if (fclose(f) != 0)
+            ret = -1;
+        if (ret != 0)
+            perror("Could not save event log");
+    }
+
+    free(block);
+    return ret;
+}
+
+int events_open(const char *filename, events_map *m) {
+    m->data = NULL;
+    m->size = 0;
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror("Could not open event log");
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        perror("fstat");
+        close(fd);
+        return -1;
+    }
+    if ((size_t)st.st_size < sizeof(events_file_header)) {
+        // Empty log
+        close(fd);
+        return 0;
+    }
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+
+    const events_file_header *h = data;
+    if (memcmp(h->magic, EVENTS_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != EVENTS_VERSION) {
+        fprintf(stderr, "%s: not a version %d event log\n", filename,
+                EVENTS_VERSION);
+        munmap(data, st.st_size);
+        return -1;
+    }
+
+    m->data = data;
+    m->size = st.st_size;
+    return 0;
+}
+
+void events_close(events_map *m) {
+    if (m->data)
+        munmap((void *)m->data, m->size);
+    m->data = NULL;
+    m->size = 0;
+}
+
+int events_next_game(const events_map *m, size_t *offset, events_game *g) {
+    if (*offset < sizeof(events_file_header))
+        *offset = sizeof(events_file_header);
+    if (*offset >= m->size)
+        return 0;
+    if (m->size - *offset < sizeof(events_block_header))
+        return -1;
+
+    const events_block_header *h =
+        (const events_block_header *)(m->data + *offset);
+    size_t size = block_size(h->text_len, h->num_events);
+    if (h->magic != EVENTS_BLOCK_MAGIC || m->size - *offset < size)
+        return -1;
+
+    const unsigned char *p = m->data + *offset + sizeof(*h);
+    g->date = h->date;
+    g->seed = h->seed;
+    g->text_len = h->text_len;
+    g->text = (const char *)p;
+    g->num_events = h->num_events;
+    g->events = (const key_event *)(p + align8(h->text_len));
+
+    *offset += size;
+    return 1;
+}
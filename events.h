@@ -0,0 +1,87 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Input event log layout (native byte order):
+//
+//   file header   "NTEV" + uint32 version
+//   game block    uint32 magic, uint32 num_events, int64 date (unix time),
+//                 uint32 seed, uint32 text_len
+//                 char      text[text_len], padded to 8 bytes
+//                 key_event events[num_events]
+//
+// Every keystroke of a game is logged, right or wrong, so a game can be
+// replayed exactly.
+
+#define EVENTS_MAGIC "NTEV"
+#define EVENTS_VERSION 1
+#define EVENTS_BLOCK_MAGIC 0x4d41474e // "NGAM"
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+} events_file_header;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t num_events;
+    int64_t date;
+    uint32_t seed;
+    uint32_t text_len;
+} events_block_header;
+
+typedef struct {
+    int64_t t_ns; // since the start of the game
+    uint32_t pos; // index in the text
+    char key;     // what was typed
+    char target;  // what should have been typed
+    uint16_t pad;
+} key_event;
+
+struct arena;
+
+// Events of the game being played
+typedef struct {
+    key_event *events;
+    uint32_t len;
+    uint32_t cap;
+    struct arena *arena; // grows from here if set, from malloc otherwise
+} event_log;
+
+// One logged game, pointing straight into the mapped file
+typedef struct {
+    int64_t date;
+    uint32_t seed;
+    uint32_t text_len;
+    const char *text; // not null-terminated
+    uint32_t num_events;
+    const key_event *events;
+} events_game;
+
+typedef struct {
+    const unsigned char *data;
+    size_t size;
+} events_map;
+
+void event_log_init(event_log *log);
+
+// Returns 0 on success, -1 on failure
+int event_log_push(event_log *log, int64_t t_ns, uint32_t pos, char key,
+                   char target);
+
+void event_log_free(event_log *log);
+
+// Append one game block
+// Returns 0 on success, -1 on failure
+int events_append_game(const char *filename, int64_t date, uint32_t seed,
+                       const char *text, const event_log *log);
+
+// Map an event log read-only
+// Returns 0 on success, -1 on failure
+int events_open(const char *filename, events_map *m);
+
+void events_close(events_map *m);
+
+// Read the game at *offset and advance *offset past it
+// Returns 1 if a game was read, 0 at end of file, -1 on a corrupt block
+int events_next_game(const events_map *m, size_t *offset, events_game *g);
@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "game.h"
+#include "timing.h"
+
+// Line breaks are never typed
+static void skip_line_breaks(game *g) {
+    while (g->current_idx < g->text_len && g->text[g->current_idx] == '\n')
+        g->current_idx++;
+}
+
+// The char that ends right before current_idx
+static uint32_t char_before(const game *g) {
+    int i = g->current_idx;
+    if (i == 0)
+        return '\0';
+    do {
+        i--;
+    } while (i > 0 && utf8_is_cont(g->text[i]));
+    uint32_t cp;
+    utf8_decode(g->text + i, g->current_idx - i, &cp);
+    return cp;
+}
+
+// Initialize the correct list from index from to the end of the text
+static void mark_chars(game *g, int from) {
+    for (int i = from; i < g->text_len; i++) {
+        int cont = utf8_is_cont(g->text[i]);
+        g->correct_keystrokes_list[i] = cont ? CONT_BYTE : 1;
+    }
+}
+
+int game_init(game *g, const char *text, int64_t start_ns, arena *mem) {
+    g->mem = mem;
+    g->text = text;
+    g->text_len = strlen(text);
+    g->current_idx = 0;
+    g->prev_key = '\0';
+    g->pending_len = 0;
+    g->retired_len = 0;
+    g->retired_chars = 0;
+    g->retired_correct = 0;
+    g->start_ns = start_ns;
+    g->key_timer_start_ns = start_ns;
+    g->end_ns = start_ns;
+
+    // Keep track of correct keystrokes for text
+    g->correct_cap = g->text_len;
+    g->correct_keystrokes_list = arena_alloc(mem, sizeof(int) * g->correct_cap);
+    if (!g->correct_keystrokes_list)
+        return -1;
+    mark_chars(g, 0);
+
+    init_stats(&g->game_stats);
+    g->game_stats.arena = mem;
+    event_log_init(&g->events);
+    g->events.arena = mem;
+    skip_line_breaks(g);
+    g->prev_key = char_before(g);
+    return 0;
+}
+
+void game_key(game *g, char input, int64_t input_ns) {
+    if (game_done(g))
+        return;
+
+    event_log_push(&g->events, input_ns - g->start_ns,
+                   g->retired_len + g->current_idx, input,
+                   g->text[g->current_idx]);
+
+    // Wait for the rest of a multi-byte char, a sequence cut short by a new
+    // char is dropped
+    if (g->pending_len > 0 && !utf8_is_cont(input))
+        g->pending_len = 0;
+    g->pending[g->pending_len++] = input;
+    if (g->pending_len < utf8_seq_len(g->pending[0]))
+        return;
+    int typed_len = g->pending_len;
+    g->pending_len = 0;
+
+    const char *target_text = g->text + g->current_idx;
+    uint32_t typed;
+    uint32_t target;
+    utf8_decode(g->pending, typed_len, &typed);
+    int target_len =
+        utf8_decode(target_text, g->text_len - g->current_idx, &target);
+    update_confusion(&g->game_stats, target, typed);
+
+    if (typed_len == target_len &&
+        memcmp(g->pending, target_text, typed_len) == 0) {
+        // Stop and start new key timer
+        int64_t elapsed_ns_for_key = input_ns - g->key_timer_start_ns;
+        g->key_timer_start_ns = input_ns;
+
+        // Add success or fail for key
+        update_key_stats(&g->game_stats, target,
+                         g->correct_keystrokes_list[g->current_idx],
+                         elapsed_ns_for_key, g->prev_key);
+
+        g->current_idx += target_len;
+        g->end_ns = input_ns;
+        skip_line_breaks(g);
+        g->prev_key = char_before(g);
+    } else {
+        g->correct_keystrokes_list[g->current_idx] = 0;
+    }
+}
+
+int game_scroll(game *g, int dropped) {
+    for (int i = 0; i < dropped; i++) {
+        if (g->correct_keystrokes_list[i] == CONT_BYTE)
+            continue;
+        g->retired_chars++;
+        if (g->correct_keystrokes_list[i] == 1)
+            g->retired_correct++;
+    }
+    g->retired_len += dropped;
+
+    int kept = g->text_len - dropped;
+    int new_len = strlen(g->text);
+    if (new_len > g->correct_cap) {
+        int *list = arena_alloc(g->mem, sizeof(int) * new_len);
+        if (!list)
+            return -1;
+        memcpy(list, g->correct_keystrokes_list, sizeof(int) * g->text_len);
+        g->correct_keystrokes_list = list;
+        g->correct_cap = new_len;
+    }
+    memmove(g->correct_keystrokes_list, g->correct_keystrokes_list + dropped,
+            sizeof(int) * kept);
+    g->text_len = new_len;
+    mark_chars(g, kept);
+    g->current_idx -= dropped;
+    return 0;
+}
+
+int game_rewrap(game *g, const char *text) {
+    int new_len = strlen(text);
+    int *list = arena_alloc(g->mem, sizeof(int) * new_len);
+    if (!list)
+        return -1;
+
+    // Walk both texts a char at a time, line breaks are always correct
+    int current = new_len;
+    int j = 0;
+    for (int i = 0; i < g->text_len; i++) {
+        if (g->text[i] == '\n')
+            continue;
+        while (j < new_len && text[j] == '\n')
+            list[j++] = 1;
+        if (i == g->current_idx)
+            current = j;
+        if (j < new_len)
+            list[j++] = g->correct_keystrokes_list[i];
+    }
+    while (j < new_len)
+        list[j++] = 1;
+
+    g->correct_keystrokes_list = list;
+    g->correct_cap = new_len;
+    g->text = text;
+    g->text_len = new_len;
+    g->current_idx = current;
+    skip_line_breaks(g);
+    g->prev_key = char_before(g);
+    return 0;
+}
+
+int game_done(const game *g) { return g->current_idx >= g->text_len; }
+
+void game_stop(game *g) {
+    g->text_len = g->current_idx;
+    g->pending_len = 0;
+}
+
+void game_live(const game *g, int64_t now_ns, double *wpm, double *acc) {
+    int typed = g->retired_chars;
+    int correct = g->retired_correct;
+    for (int i = 0; i < g->current_idx; i++) {
+        if (g->correct_keystrokes_list[i] != CONT_BYTE)
+            typed++;
+        if (g->correct_keystrokes_list[i] == 1)
+            correct++;
+    }
+    *wpm = calc_wpm(typed, ns_to_sec(now_ns - g->start_ns));
+    *acc = calc_acc(typed, correct);
+}
+
+void game_finish(game *g) {
+    // Stop timer at the last correct keystroke
+    g->elapsed_sec = ns_to_sec(g->end_ns - g->start_ns);
+
+    // Sum correct keystrokes, counting chars rather than bytes
+    int total_len = g->retired_chars;
+    g->correct_keystrokes = g->retired_correct;
+    for (int i = 0; i < g->text_len; i++) {
+        if (g->correct_keystrokes_list[i] != CONT_BYTE)
+            total_len++;
+        if (g->correct_keystrokes_list[i] == 1) {
+            g->correct_keystrokes++;
+        }
+    }
+
+    // Calculate wpm over everything typed, scrolled away or not
+    g->wpm = calc_wpm(total_len, g->elapsed_sec);
+    g->acc = calc_acc(total_len, g->correct_keystrokes);
+
+    update_total_stats(&g->game_stats, total_len, g->correct_keystrokes,
+                       g->elapsed_sec, g->wpm);
+}
+
+void game_free(game *g) {
+    g->correct_keystrokes_list = NULL;
+    event_log_free(&g->events);
+    free_stats(&g->game_stats);
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <stdint.h>
+
+#include "arena.h"
+#include "events.h"
+#include "stats.h"
+#include "utf8.h"
+
+// Entry of correct_keystrokes_list for the bytes that continue a multi-byte
+// char, only the first byte of a char counts
+#define CONT_BYTE -1
+
+// State of one test, driven by timestamped keystrokes from the terminal or
+// from a replayed event log
+typedef struct {
+    const char *text;
+    int text_len;
+    int current_idx;
+    int *correct_keystrokes_list;
+    int correct_cap;   // entries allocated in correct_keystrokes_list
+    uint32_t prev_key; // char before current_idx, '\0' at the start
+
+    // Bytes of a multi-byte char typed so far
+    char pending[UTF8_MAX_BYTES];
+    int pending_len;
+
+    // Text that has scrolled out of a passage window
+    int retired_len;   // bytes
+    int retired_chars; // chars, counted the way game_finish() counts them
+    int retired_correct;
+
+    arena *mem; // everything the game allocates, released by its owner
+
+    int64_t start_ns;
+    int64_t key_timer_start_ns;
+    int64_t end_ns; // time of the last correct keystroke
+    stats game_stats;
+    event_log events;
+
+    // Set by game_finish()
+    int correct_keystrokes;
+    double elapsed_sec;
+    double wpm;
+    double acc;
+} game;
+
+// The list of typed chars, the key history and the event log are allocated
+// from mem, which must outlive the game
+// Returns 0 on success, -1 on failure
+int game_init(game *g, const char *text, int64_t start_ns, arena *mem);
+
+// Handle one byte of input typed at input_ns, a multi-byte char is checked
+// once all of its bytes are in
+void game_key(game *g, char input, int64_t input_ns);
+
+// The first dropped chars of the text were scrolled away and the text now
+// holds more, positions in the event log keep counting from the start
+// Returns 0 on success, -1 on failure
+int game_scroll(game *g, int dropped);
+
+// The text was wrapped again at a new width, only its line breaks moved
+// Returns 0 on success, -1 on failure
+int game_rewrap(game *g, const char *text);
+
+int game_done(const game *g);
+
+// Speed and accuracy so far, for the live readout
+void game_live(const game *g, int64_t now_ns, double *wpm, double *acc);
+
+// End an interrupted test where the player stopped, the rest of the text is
+// not counted
+void game_stop(game *g);
+
+// Compute the results and add them to the game stats
+void game_finish(game *g);
+
+void game_free(game *g);
@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "events.h"
+#include "game.h"
+#include "ghost.h"
+
+// Play a logged game through a scratch game in mem for its results and,
+// with record set, the steps of its cursor
+// Returns 0 on success, -1 on failure
+static int play_logged(const events_game *logged, ghost *gh, int record,
+                       arena *mem) {
+    char *text = arena_alloc(mem, logged->text_len + 1);
+    if (!text)
+        return -1;
+    memcpy(text, logged->text, logged->text_len);
+
+    // Event times are relative to the start of the game
+    game g;
+    if (game_init(&g, text, 0, mem) != 0)
+        return -1;
+    gh->text = text;
+    gh->num_steps = 0;
+    if (record) {
+        size_t size = sizeof(ghost_step) * (logged->num_events + 1);
+        gh->steps = arena_alloc(mem, size);
+        if (!gh->steps) {
+            game_free(&g);
+            return -1;
+        }
+    }
+
+    // Line breaks are left out of the progress, so it holds at any width
+    int idx = g.current_idx;
+    uint32_t done = 0;
+    for (int i = 0; i < idx; i++)
+        done += text[i] != '\n';
+    for (uint32_t i = 0; i < logged->num_events; i++) {
+        game_key(&g, logged->events[i].key, logged->events[i].t_ns);
+        if (g.current_idx == idx)
+            continue;
+        for (; idx < g.current_idx; idx++)
+            done += text[idx] != '\n';
+        if (record) {
+            ghost_step *s = &gh->steps[gh->num_steps++];
+            s->t_ns = logged->events[i].t_ns;
+            s->done = done;
+        }
+    }
+    // A timed test ended with text left
+    if (!game_done(&g))
+        game_stop(&g);
+    game_finish(&g);
+
+    gh->elapsed_sec = g.elapsed_sec;
+    gh->wpm = g.wpm;
+    gh->acc = g.acc;
+    game_free(&g);
+    return 0;
+}
+
+// Copy the recorded ghost out of the scratch arena
+static int keep_ghost(const ghost *scratch, ghost *gh, arena *mem) {
+    *gh = *scratch;
+    size_t text_len = strlen(scratch->text);
+    gh->text = arena_alloc(mem, text_len + 1);
+    gh->steps = arena_alloc(mem, sizeof(ghost_step) * (scratch->num_steps + 1));
+    if (!gh->text || !gh->steps)
+        return -1;
+    memcpy(gh->text, scratch->text, text_len);
+    memcpy(gh->steps, scratch->steps, sizeof(ghost_step) * scratch->num_steps);
+    gh->next = 0;
+    gh->done = 0;
+    return 0;
+}
+
+int ghost_load(const char *player_name, const char *which, ghost *gh,
+               arena *mem) {
+    // 0 for the fastest game, -1 for the last one
+    int wanted;
+    if (strcmp(which, "best") == 0) {
+        wanted = 0;
+    } else if (strcmp(which, "last") == 0) {
+        wanted = -1;
+    } else {
+        wanted = atoi(which);
+        if (wanted <= 0) {
+            fprintf(stderr, "No game %s to race, use best, last or a number\n",
+                    which);
+            return -1;
+        }
+    }
+
+    char filename[256];
+    snprintf(filename, sizeof(filename), "stats/%s.events", player_name);
+    events_map m;
+    if (events_open(filename, &m) != 0)
+        return -1;
+
+    int nbr_games = 0;
+    int chosen = 0;
+    size_t chosen_offset = 0;
+    double best_wpm = 0.0;
+    size_t offset = 0;
+    events_game logged;
+    int r;
+    for (;;) {
+        size_t at = offset;
+        r = events_next_game(&m, &offset, &logged);
+        if (r != 1)
+            break;
+        nbr_games++;
+
+        if (wanted == 0) {
+            // Every game is played through once to find the fastest
+            arena scratch_mem;
+            arena_init(&scratch_mem);
+            ghost scratch;
+            if (play_logged(&logged, &scratch, 0, &scratch_mem) == 0 &&
+                scratch.wpm > best_wpm) {
+                best_wpm = scratch.wpm;
+                chosen = nbr_games;
+                chosen_offset = at;
+            }
+            arena_free(&scratch_mem);
+        } else if (wanted == -1 || wanted == nbr_games) {
+            chosen = nbr_games;
+            chosen_offset = at;
+        }
+    }
+    if (r < 0) {
+        fprintf(stderr, "%s: corrupt event log\n", filename);
+        events_close(&m);
+        return -1;
+    }
+    if (chosen == 0) {
+        fprintf(stderr, "No game %s to race in %s\n", which, filename);
+        events_close(&m);
+        return -1;
+    }
+
+    offset = chosen_offset;
+    events_next_game(&m, &offset, &logged);
+    arena scratch_mem;
+    arena_init(&scratch_mem);
+    ghost scratch;
+    int ret = play_logged(&logged, &scratch, 1, &scratch_mem);
+    if (ret == 0) {
+        scratch.number = chosen;
+        scratch.date = logged.date;
+        scratch.seed = logged.seed;
+        ret = keep_ghost(&scratch, gh, mem);
+    }
+    arena_free(&scratch_mem);
+    events_close(&m);
+    return ret;
+}
+
+int64_t ghost_next_ns(const ghost *gh) {
+    if (gh->next >= gh->num_steps)
+        return -1;
+    return gh->steps[gh->next].t_ns;
+}
+
+int ghost_advance(ghost *gh, int64_t t_ns) {
+    int moved = 0;
+    while (gh->next < gh->num_steps && gh->steps[gh->next].t_ns <= t_ns) {
+        gh->done = gh->steps[gh->next++].done;
+        moved = 1;
+    }
+    return moved;
+}
+
+int ghost_index(const ghost *gh, const char *text) {
+    uint32_t done = 0;
+    int i = 0;
+    for (; text[i]; i++) {
+        if (text[i] == '\n')
+            continue;
+        if (done == gh->done)
+            break;
+        done++;
+    }
+    return i;
+}
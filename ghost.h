@@ -0,0 +1,47 @@
+#pragma once
+#include <stdint.h>
+
+#include "arena.h"
+
+// A previous game of the player, raced in real time: its cursor advances at
+// the times the keys were typed in that game. Ghosts come from the event log
+// in stats/<player>.events, which keeps every game's text, seed and
+// keystroke times.
+
+// Point where the ghost's cursor moves on
+typedef struct {
+    int64_t t_ns;  // since the start of the game
+    uint32_t done; // bytes of text typed by then, line breaks not counted
+} ghost_step;
+
+typedef struct {
+    int number; // of the game in the event log, counting from 1
+    int64_t date;
+    uint32_t seed;
+    char *text; // as it was logged, wrapped at the width of that game
+
+    ghost_step *steps;
+    uint32_t num_steps;
+    uint32_t next; // first step still to come
+    uint32_t done;
+
+    double elapsed_sec;
+    double wpm;
+    double acc;
+} ghost;
+
+// Load a game of the player, which is "best" for the fastest, "last" or its
+// number as listed by --replay, with all its memory from mem
+// Returns 0 on success, -1 on failure
+int ghost_load(const char *player_name, const char *which, ghost *gh,
+               arena *mem);
+
+// Time of the next step since the start of the game, -1 once the ghost is done
+int64_t ghost_next_ns(const ghost *gh);
+
+// Take every step due by t_ns since the start of the game
+// Returns 1 if the ghost moved
+int ghost_advance(ghost *gh, int64_t t_ns);
+
+// Index in text, wrapped at any width, that the ghost's cursor is on
+int ghost_index(const ghost *gh, const char *text);
@@ -0,0 +1,473 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "history.h"
+
+#define CSV_HEADER "date,key,prevKey,wpm,acc"
+#define READER_BUFFER_SIZE (1 << 20)
+
+static size_t align8(size_t n) { return (n + 7) & ~(size_t)7; }
+
+size_t history_block_size(uint32_t num_rows) {
+    return sizeof(history_block_header) + sizeof(double) * num_rows +
+           align8(3 * (size_t)num_rows);
+}
+
+// Open the history file for appending, writing the file header if it is new
+static FILE *open_history(const char *filename) {
+    FILE *f = fopen(filename, "ab");
+    if (!f) {
+        perror("fopen");
+        return NULL;
+    }
+    if (ftell(f) == 0) {
+        history_file_header h;
+        memcpy(h.magic, HISTORY_MAGIC, sizeof(h.magic));
+        h.version = HISTORY_VERSION;
+        if (fwrite(&h, sizeof(h), 1, f) != 1) {
+            perror("fwrite");
+            fclose(f);
+            return NULL;
+        }
+    }
+    return f;
+}
+
+// Lay out one block in memory and write it with a single fwrite
+static int write_block(FILE *f, int64_t date, uint32_t num_rows,
+                       const double *wpm, const char *key,
+                       const char *prev_key, const uint8_t *acc) {
+    size_t size = history_block_size(num_rows);
+    unsigned char *block = calloc(1, size);
+    if (!block) {
+        perror("calloc failed");
+        return -1;
+    }
+
+    history_block_header h = {HISTORY_BLOCK_MAGIC, num_rows, date};
+    unsigned char *p = block;
+    memcpy(p, &h, sizeof(h));
+    p += sizeof(h);
+    memcpy(p, wpm, sizeof(double) * num_rows);
+    p += sizeof(double) * num_rows;
+    memcpy(p, key, num_rows);
+    p += num_rows;
+    memcpy(p, prev_key, num_rows);
+    p += num_rows;
+    memcpy(p, acc, num_rows);
+
+    int ret = fwrite(block, size, 1, f) == 1 ? 0 : -1;
+    if (ret != 0)
+        perror("fwrite");
+    free(block);
+    return ret;
+}
+
+int history_append_game(const char *filename, int64_t date, const stats *s) {
+    uint32_t num_rows = 0;
+    for (int i = 0; i < NUM_KEYS; i++)
+        num_rows += s->per_key[i].history_len;
+    if (num_rows == 0)
+        return 0;
+
+    // Gather the per-key histories into columns
+    double *wpm = malloc(sizeof(double) * num_rows);
+    char *cols = malloc(3 * (size_t)num_rows);
+    if (!wpm || !cols) {
+        perror("malloc failed");
+        free(wpm);
+        free(cols);
+        return -1;
+    }
+    char *key = cols;
+    char *prev_key = cols + num_rows;
+    uint8_t *acc = (uint8_t *)cols + 2 * num_rows;
+
+    uint32_t row = 0;
+    for (int i = 0; i < NUM_KEYS; i++) {
+        const key_stats *k = &s->per_key[i];
+        for (const key_press_block *b = k->history; b; b = b->next) {
+            for (int j = 0; j < b->len; j++) {
+                wpm[row] = b->presses[j].wpm;
+                key[row] = k->key;
+                prev_key[row] = b->presses[j].prev_key;
+                acc[row] = b->presses[j].correct;
+                row++;
+            }
+        }
+    }
+
+    int ret = -1;
+    FILE *f = open_history(filename);
+    if (f) {
+        ret = write_block(f, date, num_rows, wpm, key, prev_key, acc);
+        if (fclose(f) != 0)
+            ret = -1;
+    }
+
+    free(wpm);
+    free(cols);
+    return ret;
+}
+
+static int check_file_header(const history_file_header *h,
+                             const char *filename) {
+    if (memcmp(h->magic, HISTORY_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != HISTORY_VERSION) {
+        fprintf(stderr, "%s: not a version %d key history file\n", filename,
+                HISTORY_VERSION);
+        return -1;
+    }
+    return 0;
+}
+
+int history_open(const char *filename, history_map *m) {
+    m->data = NULL;
+    m->size = 0;
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror("Could not open history");
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        perror("fstat");
+        close(fd);
+        return -1;
+    }
+    if ((size_t)st.st_size < sizeof(history_file_header)) {
+        // Empty history
+        close(fd);
+        return 0;
+    }
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+
+    if (check_file_header(data, filename) != 0) {
+        munmap(data, st.st_size);
+        return -1;
+    }
+
+    m->data = data;
+    m->size = st.st_size;
+    return 0;
+}
+
+void history_close(history_map *m) {
+    if (m->data)
+        munmap((void *)m->data, m->size);
+    m->data = NULL;
+    m->size = 0;
+}
+
+int history_next_block(const history_map *m, size_t *offset,
+                       history_block *b) {
+    if (*offset < sizeof(history_file_header))
+        *offset = sizeof(history_file_header);
+    if (*offset >= m->size)
+        return 0;
+    if (m->size - *offset < sizeof(history_block_header))
+        return -1;
+
+    const history_block_header *h =
+        (const history_block_header *)(m->data + *offset);
+    size_t size = history_block_size(h->num_rows);
+    if (h->magic != HISTORY_BLOCK_MAGIC || m->size - *offset < size)
+        return -1;
+
+    const unsigned char *p = m->data + *offset + sizeof(*h);
+    b->date = h->date;
+    b->num_rows = h->num_rows;
+    b->wpm = (const double *)p;
+    p += sizeof(double) * h->num_rows;
+    b->key = (const char *)p;
+    b->prev_key = b->key + h->num_rows;
+    b->acc = (const uint8_t *)b->prev_key + h->num_rows;
+
+    *offset += size;
+    return 1;
+}
+
+long history_compact(const char *filename, int64_t cutoff) {
+    history_map m;
+    if (history_open(filename, &m) != 0)
+        return -1;
+    if (!m.data)
+        return 0;
+
+    char tmp_filename[512];
+    snprintf(tmp_filename, sizeof(tmp_filename), "%s.tmp", filename);
+    FILE *f = fopen(tmp_filename, "wb");
+    if (!f) {
+        perror("fopen");
+        history_close(&m);
+        return -1;
+    }
+
+    // Blocks are copied as they are, header and padding included
+    long dropped = 0;
+    int ok = fwrite(m.data, sizeof(history_file_header), 1, f) == 1;
+    size_t offset = sizeof(history_file_header);
+    history_block b;
+    int r = 0;
+    while (ok && (r = history_next_block(&m, &offset, &b)) == 1) {
+        if (b.date < cutoff) {
+            dropped += b.num_rows;
+            continue;
+        }
+        size_t size = history_block_size(b.num_rows);
+        ok = fwrite(m.data + offset - size, size, 1, f) == 1;
+    }
+    history_close(&m);
+    if (r < 0) {
+        fprintf(stderr, "%s: corrupt key history\n", filename);
+        ok = 0;
+    }
+
+    if (fclose(f) != 0)
+        ok = 0;
+    if (!ok || rename(tmp_filename, filename) != 0) {
+        perror("Could not compact key history");
+        remove(tmp_filename);
+        return -1;
+    }
+    return dropped;
+}
+
+int history_reader_open(const char *filename, history_reader *r) {
+    r->buf = NULL;
+    r->cap = 0;
+    r->f = fopen(filename, "rb");
+    if (!r->f) {
+        perror("Could not open history");
+        return -1;
+    }
+    setvbuf(r->f, NULL, _IOFBF, READER_BUFFER_SIZE);
+
+    history_file_header h;
+    if (fread(&h, sizeof(h), 1, r->f) != 1) {
+        // Empty history
+        return 0;
+    }
+    if (check_file_header(&h, filename) != 0) {
+        fclose(r->f);
+        r->f = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+int history_reader_next(history_reader *r, history_block *b) {
+    history_block_header h;
+    if (fread(&h, sizeof(h), 1, r->f) != 1)
+        return 0;
+    if (h.magic != HISTORY_BLOCK_MAGIC)
+        return -1;
+
+    // The columns are read into a buffer reused across blocks
+    size_t size = history_block_size(h.num_rows) - sizeof(h);
+    if (size > r->cap) {
+        unsigned char *buf = realloc(r->buf, size);
+        if (!buf) {
+            perror("realloc failed");
+            return -1;
+        }
+        r->buf = buf;
+        r->cap = size;
+    }
+    if (size > 0 && fread(r->buf, size, 1, r->f) != 1)
+        return -1;
+
+    b->date = h.date;
+    b->num_rows = h.num_rows;
+    b->wpm = (const double *)r->buf;
+    b->key = (const char *)r->buf + sizeof(double) * h.num_rows;
+    b->prev_key = b->key + h.num_rows;
+    b->acc = (const uint8_t *)b->prev_key + h.num_rows;
+    return 1;
+}
+
+void history_reader_close(history_reader *r) {
+    if (r->f)
+        fclose(r->f);
+    free(r->buf);
+    r->f = NULL;
+    r->buf = NULL;
+    r->cap = 0;
+}
+
+// Rows of one game collected while importing CSV
+typedef struct {
+    int64_t date;
+    uint32_t len;
+    uint32_t cap;
+    double *wpm;
+    char *key;
+    char *prev_key;
+    uint8_t *acc;
+} row_buffer;
+
+static int row_buffer_push(row_buffer *r, double wpm, char key, char prev_key,
+                           uint8_t acc) {
+    if (r->len >= r->cap) {
+        uint32_t cap = r->cap ? r->cap * 2 : 256;
+        double *w = realloc(r->wpm, sizeof(double) * cap);
+        if (w)
+            r->wpm = w;
+        char *k = realloc(r->key, cap);
+        if (k)
+            r->key = k;
+        char *p = realloc(r->prev_key, cap);
+        if (p)
+            r->prev_key = p;
+        uint8_t *a = realloc(r->acc, cap);
+        if (a)
+            r->acc = a;
+        if (!w || !k || !p || !a) {
+            perror("realloc failed");
+            return -1;
+        }
+        r->cap = cap;
+    }
+    r->wpm[r->len] = wpm;
+    r->key[r->len] = key;
+    r->prev_key[r->len] = prev_key;
+    r->acc[r->len] = acc;
+    r->len++;
+    return 0;
+}
+
+static int64_t parse_date(const char *s) {
+    struct tm t;
+    memset(&t, 0, sizeof(t));
+    if (sscanf(s, "%d-%d-%d %d:%d:%d", &t.tm_year, &t.tm_mon, &t.tm_mday,
+               &t.tm_hour, &t.tm_min, &t.tm_sec) != 6)
+        return -1;
+    t.tm_year -= 1900;
+    t.tm_mon -= 1;
+    t.tm_isdst = -1;
+    return mktime(&t);
+}
+
+int history_import_csv(const char *csv_filename, const char *filename) {
+    FILE *csv = fopen(csv_filename, "r");
+    if (!csv) {
+        perror("Could not open CSV history");
+        return -1;
+    }
+    FILE *f = open_history(filename);
+    if (!f) {
+        fclose(csv);
+        return -1;
+    }
+
+    row_buffer rows;
+    memset(&rows, 0, sizeof(rows));
+    int imported = 0;
+    int ret = 0;
+
+    // Rows look like "YYYY-MM-DD HH:MM:SS,k,p,wpm,acc" where p may be empty
+    char line[128];
+    while (ret == 0 && fgets(line, sizeof(line), csv)) {
+        if (strlen(line) < 25 || line[19] != ',' || line[21] != ',')
+            continue; // header or malformed row
+
+        int64_t date = parse_date(line);
+        if (date < 0)
+            continue;
+
+        char key = line[20];
+        char prev_key = '\0';
+        const char *rest = &line[23];
+        if (line[22] != ',') {
+            prev_key = line[22];
+            rest = &line[24];
+        }
+        double wpm;
+        int acc;
+        if (sscanf(rest, "%lf,%d", &wpm, &acc) != 2)
+            continue;
+
+        // Every game shares one date, so a new date starts a new block
+        if (rows.len > 0 && date != rows.date) {
+            ret = write_block(f, rows.date, rows.len, rows.wpm, rows.key,
+                              rows.prev_key, rows.acc);
+            rows.len = 0;
+        }
+        rows.date = date;
+        if (ret == 0)
+            ret = row_buffer_push(&rows, wpm, key, prev_key, acc ? 1 : 0);
+        imported++;
+    }
+    if (ret == 0 && rows.len > 0)
+        ret = write_block(f, rows.date, rows.len, rows.wpm, rows.key,
+                          rows.prev_key, rows.acc);
+
+    free(rows.wpm);
+    free(rows.key);
+    free(rows.prev_key);
+    free(rows.acc);
+    fclose(csv);
+    if (fclose(f) != 0)
+        ret = -1;
+
+    return ret == 0 ? imported : -1;
+}
+
+int history_export_csv(const char *filename, const char *csv_filename) {
+    history_map m;
+    if (history_open(filename, &m) != 0)
+        return -1;
+
+    FILE *csv = fopen(csv_filename, "w");
+    if (!csv) {
+        perror("fopen");
+        history_close(&m);
+        return -1;
+    }
+    fprintf(csv, "%s\n", CSV_HEADER);
+
+    int exported = 0;
+    size_t offset = 0;
+    history_block b;
+    int r;
+    while ((r = history_next_block(&m, &offset, &b)) == 1) {
+        time_t date = b.date;
+        char datetimebuf[20]; // "YYYY-MM-DD HH:MM:SS"
+        strftime(datetimebuf, sizeof(datetimebuf), "%Y-%m-%d %H:%M:%S",
+                 localtime(&date));
+
+        for (uint32_t i = 0; i < b.num_rows; i++) {
+            if (b.prev_key[i] == '\0') {
+                fprintf(csv, "%s,%c,,%.6f,%d\n", datetimebuf, b.key[i],
+                        b.wpm[i], b.acc[i]);
+            } else {
+                fprintf(csv, "%s,%c,%c,%.6f,%d\n", datetimebuf, b.key[i],
+                        b.prev_key[i], b.wpm[i], b.acc[i]);
+            }
+        }
+        exported += b.num_rows;
+    }
+    if (r < 0)
+        fprintf(stderr, "%s: corrupt block at offset %zu\n", filename, offset);
+
+    if (fclose(csv) != 0) {
+        perror("fclose");
+        exported = -1;
+    }
+    history_close(&m);
+    return r < 0 ? -1 : exported;
+}
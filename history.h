@@ -0,0 +1,96 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "stats.h"
+
+// Binary key history file layout (native byte order):
+//
+//   file header   "NTKH" + uint32 version
+//   game block    uint32 magic, uint32 num_rows, int64 date (unix time)
+//                 double  wpm[num_rows]
+//                 char    key[num_rows]
+//                 char    prev_key[num_rows]   ('\0' if none)
+//                 uint8_t acc[num_rows]
+//                 padding to the next 8 byte boundary
+//
+// Blocks are only ever appended, one per game, so the file can be mapped and
+// every column read in place.
+
+#define HISTORY_MAGIC "NTKH"
+#define HISTORY_VERSION 1
+#define HISTORY_BLOCK_MAGIC 0x4b42544e // "NTBK"
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+} history_file_header;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t num_rows;
+    int64_t date;
+} history_block_header;
+
+// One game block, pointing straight into the mapped file
+typedef struct {
+    int64_t date;
+    uint32_t num_rows;
+    const double *wpm;
+    const char *key;
+    const char *prev_key;
+    const uint8_t *acc;
+} history_block;
+
+typedef struct {
+    const unsigned char *data;
+    size_t size;
+} history_map;
+
+// Sequential reader holding at most one block in memory
+typedef struct {
+    FILE *f;
+    unsigned char *buf;
+    size_t cap;
+} history_reader;
+
+// Size in bytes of a block holding num_rows rows, header included
+size_t history_block_size(uint32_t num_rows);
+
+// Append one block with all keystrokes recorded in s
+// Returns 0 on success, -1 on failure
+int history_append_game(const char *filename, int64_t date, const stats *s);
+
+// Map a history file read-only
+// Returns 0 on success, -1 on failure
+int history_open(const char *filename, history_map *m);
+
+void history_close(history_map *m);
+
+// Read the block at *offset and advance *offset past it
+// Returns 1 if a block was read, 0 at end of file, -1 on a corrupt block
+int history_next_block(const history_map *m, size_t *offset,
+                       history_block *b);
+
+// Drop the blocks of games played before cutoff
+// Returns number of dropped rows, -1 on failure
+long history_compact(const char *filename, int64_t cutoff);
+
+// Open a history file for reading block by block through a large buffer
+// Returns 0 on success, -1 on failure
+int history_reader_open(const char *filename, history_reader *r);
+
+// Read the next block, valid until the next call
+// Returns 1 if a block was read, 0 at end of file, -1 on a corrupt block
+int history_reader_next(history_reader *r, history_block *b);
+
+void history_reader_close(history_reader *r);
+
+// Import rows from the old "date,key,prevKey,wpm,acc" CSV format
+// Returns number of imported rows, -1 on failure
+int history_import_csv(const char *csv_filename, const char *filename);
+
+// Write the whole history as "date,key,prevKey,wpm,acc" CSV
+// Returns number of exported rows, -1 on failure
+int history_export_csv(const char *filename, const char *csv_filename);
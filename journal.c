@@ -0,0 +1,161 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "journal.h"
+
+static size_t align8(size_t n) { return (n + 7) & ~(size_t)7; }
+
+static void journal_filename(const char *player_name, char *filename,
+                             size_t size) {
+    snprintf(filename, size, "stats/%s.journal", player_name);
+}
+
+// Write all of buf, retrying after short writes and signals
+static int write_all(int fd, const void *buf, size_t size) {
+    const char *p = buf;
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        size -= n;
+    }
+    return 0;
+}
+
+int journal_open(journal *j, const char *player_name, int64_t date,
+                 uint32_t seed, const char *text) {
+    j->logged = 0;
+    j->buffered = 0;
+    journal_filename(player_name, j->filename, sizeof(j->filename));
+
+    j->fd = open(j->filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (j->fd < 0) {
+        perror("Could not open journal");
+        return -1;
+    }
+
+    uint32_t text_len = strlen(text);
+    size_t size = sizeof(journal_header) + align8(text_len);
+    unsigned char *head = calloc(1, size);
+    if (!head) {
+        perror("calloc failed");
+        journal_close(j, 1);
+        return -1;
+    }
+    journal_header h;
+    memcpy(h.magic, JOURNAL_MAGIC, sizeof(h.magic));
+    h.version = JOURNAL_VERSION;
+    h.date = date;
+    h.seed = seed;
+    h.text_len = text_len;
+    memcpy(head, &h, sizeof(h));
+    memcpy(head + sizeof(h), text, text_len);
+
+    int ret = write_all(j->fd, head, size);
+    free(head);
+    if (ret != 0) {
+        perror("Could not write journal");
+        journal_close(j, 1);
+        return -1;
+    }
+    return 0;
+}
+
+void journal_add(journal *j, const event_log *log) {
+    if (j->fd < 0)
+        return;
+    while (j->logged < log->len) {
+        j->buffer[j->buffered++] = log->events[j->logged++];
+        if (j->buffered == JOURNAL_BUFFER_EVENTS)
+            journal_flush(j);
+    }
+}
+
+void journal_flush(journal *j) {
+    if (j->fd < 0 || j->buffered == 0)
+        return;
+    // A failed write leaves a shorter journal, which is still replayable
+    write_all(j->fd, j->buffer, sizeof(key_event) * j->buffered);
+    j->buffered = 0;
+}
+
+void journal_close(journal *j, int saved) {
+    if (j->fd < 0)
+        return;
+    if (!saved)
+        journal_flush(j);
+    close(j->fd);
+    j->fd = -1;
+    if (saved)
+        unlink(j->filename);
+}
+
+int journal_recover(const char *player_name, journal_game *g) {
+    g->text = NULL;
+    event_log_init(&g->events);
+
+    char filename[256];
+    journal_filename(player_name, filename, sizeof(filename));
+    FILE *f = fopen(filename, "rb");
+    if (!f)
+        return 0;
+
+    journal_header h;
+    if (fread(&h, sizeof(h), 1, f) != 1 ||
+        memcmp(h.magic, JOURNAL_MAGIC, sizeof(h.magic)) != 0 ||
+        h.version != JOURNAL_VERSION) {
+        fprintf(stderr, "%s: not a version %d journal\n", filename,
+                JOURNAL_VERSION);
+        fclose(f);
+        return -1;
+    }
+
+    g->date = h.date;
+    g->seed = h.seed;
+    g->text = calloc(1, align8(h.text_len) + 1);
+    if (!g->text) {
+        perror("calloc failed");
+        fclose(f);
+        return -1;
+    }
+    if (fread(g->text, align8(h.text_len), 1, f) != 1 && h.text_len > 0) {
+        fprintf(stderr, "%s: truncated journal\n", filename);
+        fclose(f);
+        journal_game_free(g);
+        return -1;
+    }
+    g->text[h.text_len] = '\0';
+
+    // An event torn by the interruption is dropped
+    key_event e;
+    while (fread(&e, sizeof(e), 1, f) == 1) {
+        if (event_log_push(&g->events, e.t_ns, e.pos, e.key, e.target) !=
+            0) {
+            fclose(f);
+            journal_game_free(g);
+            return -1;
+        }
+    }
+    fclose(f);
+    return 1;
+}
+
+void journal_game_free(journal_game *g) {
+    free(g->text);
+    g->text = NULL;
+    event_log_free(&g->events);
+}
+
+void journal_remove(const char *player_name) {
+    char filename[256];
+    journal_filename(player_name, filename, sizeof(filename));
+    unlink(filename);
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <stdint.h>
+
+#include "events.h"
+
+// Write-ahead journal of the game being played, stats/<player>.journal
+// (native byte order):
+//
+//   header        "NTJL" + uint32 version, int64 date (unix time),
+//                 uint32 seed, uint32 text_len
+//                 char      text[text_len], padded to 8 bytes
+//   events        key_event, appended while the game is played
+//
+// Events are buffered and written JOURNAL_BUFFER_EVENTS at a time, and once
+// more if the game is interrupted. The journal is removed when the results
+// of the game are saved, so one that is left behind is a game that never
+// was and is folded into the stats on the next start.
+
+#define JOURNAL_MAGIC "NTJL"
+#define JOURNAL_VERSION 1
+#define JOURNAL_BUFFER_EVENTS 64
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    int64_t date;
+    uint32_t seed;
+    uint32_t text_len;
+} journal_header;
+
+typedef struct {
+    int fd; // -1 if there is no journal
+    char filename[256];
+    uint32_t logged; // events of the log taken into the buffer
+    key_event buffer[JOURNAL_BUFFER_EVENTS];
+    int buffered;
+} journal;
+
+// Start the journal of a new game, replacing any old one
+// Returns 0 on success, -1 on failure
+int journal_open(journal *j, const char *player_name, int64_t date,
+                 uint32_t seed, const char *text);
+
+// Buffer the events of log that are not in the journal yet, writing the
+// buffer out when it is full
+void journal_add(journal *j, const event_log *log);
+
+// Write out the buffered events, only using write() so it can be called from
+// a signal handler
+void journal_flush(journal *j);
+
+// Close the journal, removing it if the game has been saved
+void journal_close(journal *j, int saved);
+
+// An interrupted game read back from a journal
+typedef struct {
+    int64_t date;
+    uint32_t seed;
+    char *text; // null-terminated
+    event_log events;
+} journal_game;
+
+// Read the journal left behind by an interrupted game of the player
+// Returns 1 if there was one, 0 if not, -1 on failure
+int journal_recover(const char *player_name, journal_game *g);
+
+void journal_game_free(journal_game *g);
+
+// Remove the player's journal once its game has been saved
+void journal_remove(const char *player_name);
@@ -0,0 +1,56 @@
+import numpy as np
+import pandas as pd
+
+from neotapstats import local_datetimes
+
+# Layout of stats/<player>.rollup-<tier>.bin, see rollup.h
+ROLLUP_MAGIC = b"NTRU"
+ROLLUP_VERSION = 3
+ROLLUP_BLOCK_MAGIC = 0x4B42524E
+ROLLUP_TIERS = ["game", "day", "week"]
+ROLLUP_FILE_HEADER = np.dtype([("magic", "S4"), ("version", "=u4"), ("tier", "=u4"), ("pad", "=u4"),
+                               ("compacted_before", "=i8")])
+ROLLUP_BLOCK_HEADER = np.dtype([("magic", "=u4"), ("num_rows", "=u4"), ("period", "=i8")])
+ROLLUP_ROW = np.dtype([
+    ("key", "S1"), ("pad", "V3"), ("count", "=u4"), ("correct", "=u4"), ("pad2", "V4"),
+    ("wpm_sum", "=f8"), ("wpm_min", "=f8"), ("wpm_max", "=f8"),
+])
+
+
+def load_key_rollup(player, tier):
+    """Load a rollup tier as a period,key,count,wpm,wpm_min,wpm_max,acc DataFrame."""
+    path = f"stats/{player}.rollup-{tier}.bin"
+    data = np.fromfile(path, dtype=np.uint8)
+
+    header = data[:ROLLUP_FILE_HEADER.itemsize].view(ROLLUP_FILE_HEADER)[0]
+    if header["magic"] != ROLLUP_MAGIC or header["version"] != ROLLUP_VERSION:
+        raise ValueError(f"{path}: not a version {ROLLUP_VERSION} rollup file")
+
+    periods, rows = [], []
+    offset = ROLLUP_FILE_HEADER.itemsize
+    while offset < len(data):
+        block = data[offset:offset + ROLLUP_BLOCK_HEADER.itemsize].view(ROLLUP_BLOCK_HEADER)[0]
+        if block["magic"] != ROLLUP_BLOCK_MAGIC:
+            raise ValueError(f"{path}: corrupt block at offset {offset}")
+        n = int(block["num_rows"])
+        offset += ROLLUP_BLOCK_HEADER.itemsize
+        rows.append(data[offset:offset + ROLLUP_ROW.itemsize * n].view(ROLLUP_ROW))
+        periods.append(np.full(n, block["period"], dtype=np.int64))
+        offset += ROLLUP_ROW.itemsize * n
+
+    if not rows:
+        return pd.DataFrame(columns=["period", "key", "count", "wpm", "wpm_min", "wpm_max", "acc"])
+
+    r = np.concatenate(rows)
+    r = r[r["count"] > 0]
+    period = np.concatenate(periods)[np.concatenate(rows)["count"] > 0]
+    count = r["count"].astype(np.int64)
+    return pd.DataFrame({
+        "period": local_datetimes(period),
+        "key": r["key"].astype(str),
+        "count": count,
+        "wpm": r["wpm_sum"] / count,
+        "wpm_min": r["wpm_min"],
+        "wpm_max": r["wpm_max"],
+        "acc": r["correct"] / count * 100.0,
+    })
@@ -3,21 +3,43 @@ import matplotlib.pyplot as plt
 import seaborn as sns
 import argparse
 
+import neotapstats
+from key_history import ROLLUP_TIERS, load_key_rollup
+
 # --- Parse command-line arguments ---
 parser = argparse.ArgumentParser(description="Plot typing speed over time for a specific key.")
 parser.add_argument("-p", "--player", type=str, required=True, help="Player to show stats for")
 parser.add_argument("-k", "--key", type=str, required=True, help="The key to plot")
 parser.add_argument("-s", "--smoothness", type=int, default=1, help="Add rolling average of the graph")
+parser.add_argument("-t", "--tier", choices=ROLLUP_TIERS, help="Plot the mean speed per game, day or week from the rollups")
 args = parser.parse_args()
 player = args.player
 key_to_plot = args.key
 smoothness = args.smoothness
 
-# --- Load CSV ---
-df = pd.read_csv(f"stats/{player}.key-history.csv")
+# --- Long-range trend from the rollups, one row per period ---
+if args.tier:
+    df = load_key_rollup(player, args.tier)
+    df_key = df[df['key'] == key_to_plot].copy()
+    if df_key.empty:
+        print(f"No data found for key '{key_to_plot}'")
+        exit()
+
+    df_key['wpm_smooth'] = df_key['wpm'].rolling(window=smoothness, min_periods=1).mean()
+
+    plt.figure(figsize=(14, 6))
+    plt.fill_between(df_key['period'], df_key['wpm_min'], df_key['wpm_max'], color='orange', alpha=0.2, label='Min/max WPM')
+    sns.lineplot(data=df_key, x='period', y='wpm_smooth', marker='o', color='orange', label='Mean WPM')
+    plt.title(f"Typing Speed per {args.tier.capitalize()} for Key '{key_to_plot}', smoothness={smoothness}", fontsize=16)
+    plt.xlabel(args.tier.capitalize(), fontsize=12)
+    plt.ylabel("WPM", fontsize=12)
+    plt.legend()
+    plt.tight_layout()
+    plt.show()
+    exit()
 
-# Filter for the specified key
-df_key = df[df['key'] == key_to_plot].copy()
+# --- Load the keystrokes of the key, filtered by the library ---
+df_key = neotapstats.key_samples_frame(player, key_to_plot)
 
 if df_key.empty:
     print(f"No data found for key '{key_to_plot}'")
@@ -0,0 +1,53 @@
+#include "latency.h"
+
+static int bucket_of(int64_t time_ns) {
+    uint64_t us = time_ns > 0 ? (uint64_t)time_ns / 1000 : 0;
+    if (us >> LATENCY_MIN_SHIFT == 0)
+        return 0;
+
+    int octave = 63 - __builtin_clzll(us) - LATENCY_MIN_SHIFT;
+    if (octave >= LATENCY_OCTAVES)
+        return LATENCY_BUCKETS - 1;
+
+    // The bits right after the leading one pick the linear bucket
+    int shift = octave + LATENCY_MIN_SHIFT - LATENCY_SUB_BITS;
+    int sub = (us >> shift) & (LATENCY_SUB_BUCKETS - 1);
+    return octave * LATENCY_SUB_BUCKETS + sub;
+}
+
+// Largest latency counted in a bucket, in microseconds
+static uint64_t bucket_limit(int bucket) {
+    int octave = bucket / LATENCY_SUB_BUCKETS;
+    int sub = bucket % LATENCY_SUB_BUCKETS;
+    int shift = octave + LATENCY_MIN_SHIFT - LATENCY_SUB_BITS;
+    return ((uint64_t)(LATENCY_SUB_BUCKETS + sub + 1) << shift) - 1;
+}
+
+void latency_add(latency_hist *h, int64_t time_ns) {
+    h->count[bucket_of(time_ns)]++;
+}
+
+void latency_merge(latency_hist *dest, const latency_hist *src) {
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+        dest->count[i] += src->count[i];
+}
+
+double latency_percentile(const latency_hist *h, double p) {
+    uint64_t total = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+        total += h->count[i];
+    if (total == 0)
+        return 0.0;
+
+    // Rank of the sample, counting from 1
+    uint64_t rank = (uint64_t)(p / 100.0 * total + 0.5);
+    if (rank < 1)
+        rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += h->count[i];
+        if (seen >= rank)
+            return bucket_limit(i) / 1e6;
+    }
+    return bucket_limit(LATENCY_BUCKETS - 1) / 1e6;
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <stdint.h>
+
+// Log-bucketed keystroke latency histogram: every power of two from
+// LATENCY_MIN_US up is split into LATENCY_SUB_BUCKETS linear buckets, so any
+// latency is known to within 1/LATENCY_SUB_BUCKETS of its value whatever the
+// number of samples. Faster keystrokes count in the first bucket, slower ones
+// than the range in the last.
+
+#define LATENCY_SUB_BITS 3
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+#define LATENCY_MIN_SHIFT 12 // 4.1 ms, in microseconds
+#define LATENCY_OCTAVES 10   // up to 4.2 s
+#define LATENCY_BUCKETS (LATENCY_OCTAVES * LATENCY_SUB_BUCKETS)
+
+typedef struct {
+    uint32_t count[LATENCY_BUCKETS];
+} latency_hist;
+
+void latency_add(latency_hist *h, int64_t time_ns);
+
+void latency_merge(latency_hist *dest, const latency_hist *src);
+
+// Upper bound of the bucket holding the p-th percentile, in seconds
+// Returns 0 if the histogram is empty
+double latency_percentile(const latency_hist *h, double p);
@@ -0,0 +1,244 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "leaderboard.h"
+
+static size_t index_size(uint32_t cap) {
+    return sizeof(leaderboard_header) +
+           (size_t)cap * (sizeof(leaderboard_entry) +
+                          (1 + LB_NUM_ORDERS) * sizeof(uint32_t));
+}
+
+// Point the arrays into the mapping, laid out for the header's cap
+static void point_arrays(leaderboard *lb) {
+    unsigned char *p = lb->data;
+    lb->h = (leaderboard_header *)p;
+    uint32_t cap = lb->h->cap;
+    lb->entries = (leaderboard_entry *)(p + sizeof(leaderboard_header));
+    lb->by_name = (uint32_t *)(lb->entries + cap);
+    for (int o = 0; o < LB_NUM_ORDERS; o++)
+        lb->order[o] = lb->by_name + (size_t)cap * (o + 1);
+}
+
+static void unmap(leaderboard *lb) {
+    if (lb->data)
+        munmap(lb->data, lb->size);
+    if (lb->fd >= 0)
+        close(lb->fd);
+    lb->data = NULL;
+    lb->fd = -1;
+}
+
+void leaderboard_close(leaderboard *lb) { unmap(lb); }
+
+int leaderboard_open(const char *filename, int writable, leaderboard *lb) {
+    memset(lb, 0, sizeof(*lb));
+    snprintf(lb->filename, sizeof(lb->filename), "%s", filename);
+    lb->writable = writable;
+    lb->fd = open(filename, writable ? O_RDWR : O_RDONLY);
+    if (lb->fd < 0)
+        return errno == ENOENT ? 0 : -1;
+
+    struct stat st;
+    leaderboard_header h;
+    int ok = fstat(lb->fd, &st) == 0 &&
+             pread(lb->fd, &h, sizeof(h), 0) == sizeof(h) &&
+             memcmp(h.magic, LEADERBOARD_MAGIC, sizeof(h.magic)) == 0 &&
+             h.version == LEADERBOARD_VERSION && h.count <= h.cap &&
+             !h.dirty && (size_t)st.st_size == index_size(h.cap);
+    if (ok) {
+        int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+        lb->data = mmap(NULL, st.st_size, prot, MAP_SHARED, lb->fd, 0);
+        if (lb->data == MAP_FAILED) {
+            perror("mmap");
+            lb->data = NULL;
+            ok = 0;
+        }
+    }
+    if (!ok) {
+        fprintf(stderr, "%s: ignoring invalid leaderboard\n", filename);
+        unmap(lb);
+        return -1;
+    }
+    lb->size = st.st_size;
+    point_arrays(lb);
+    return 1;
+}
+
+// Write a copy of the index with room for cap players, or an empty one if
+// none is open, and open it in place of the old one
+// Returns 0 on success, -1 on failure
+static int rewrite(leaderboard *lb, uint32_t cap) {
+    char tmp_filename[512];
+    snprintf(tmp_filename, sizeof(tmp_filename), "%s.tmp", lb->filename);
+
+    leaderboard copy = *lb;
+    copy.writable = 1;
+    copy.size = index_size(cap);
+    copy.data = MAP_FAILED;
+    copy.fd = open(tmp_filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (copy.fd >= 0 && ftruncate(copy.fd, copy.size) == 0)
+        copy.data = mmap(NULL, copy.size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                         copy.fd, 0);
+    if (copy.data == MAP_FAILED) {
+        perror("Could not save leaderboard");
+        copy.data = NULL;
+        unmap(&copy);
+        remove(tmp_filename);
+        return -1;
+    }
+
+    leaderboard_header *h = copy.data;
+    memcpy(h->magic, LEADERBOARD_MAGIC, sizeof(h->magic));
+    h->version = LEADERBOARD_VERSION;
+    h->cap = cap;
+    h->count = lb->data ? lb->h->count : 0;
+    point_arrays(&copy);
+    if (lb->data) {
+        memcpy(copy.entries, lb->entries,
+               sizeof(leaderboard_entry) * h->count);
+        memcpy(copy.by_name, lb->by_name, sizeof(uint32_t) * h->count);
+        for (int o = 0; o < LB_NUM_ORDERS; o++)
+            memcpy(copy.order[o], lb->order[o], sizeof(uint32_t) * h->count);
+    }
+
+    if (rename(tmp_filename, lb->filename) != 0) {
+        perror("Could not save leaderboard");
+        unmap(&copy);
+        remove(tmp_filename);
+        return -1;
+    }
+    unmap(lb);
+    *lb = copy;
+    return 0;
+}
+
+int leaderboard_create(const char *filename, leaderboard *lb) {
+    memset(lb, 0, sizeof(*lb));
+    snprintf(lb->filename, sizeof(lb->filename), "%s", filename);
+    lb->fd = -1;
+    return rewrite(lb, LB_MIN_CAP);
+}
+
+// Binary search of the names, returns where the player is or would be
+// inserted in by_name
+static uint32_t search(const leaderboard *lb, const char *player,
+                       int *found) {
+    uint32_t lo = 0;
+    uint32_t hi = lb->h->count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(lb->entries[lb->by_name[mid]].player, player);
+        if (cmp == 0) {
+            *found = 1;
+            return mid;
+        }
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *found = 0;
+    return lo;
+}
+
+// Whether entry a ranks above entry b, ties go by name
+static int ranks_above(const leaderboard *lb, int order, uint32_t a,
+                       uint32_t b) {
+    const leaderboard_entry *ea = &lb->entries[a];
+    const leaderboard_entry *eb = &lb->entries[b];
+    if (ea->score[order] > eb->score[order])
+        return 1;
+    if (ea->score[order] < eb->score[order])
+        return 0;
+    return strcmp(ea->player, eb->player) < 0;
+}
+
+static void swap_ranks(leaderboard *lb, int order, uint32_t rank) {
+    uint32_t *ids = lb->order[order];
+    uint32_t tmp = ids[rank];
+    ids[rank] = ids[rank + 1];
+    ids[rank + 1] = tmp;
+    lb->entries[ids[rank]].rank[order] = rank;
+    lb->entries[ids[rank + 1]].rank[order] = rank + 1;
+}
+
+// Move an entry whose score changed to its place in an order
+static void reposition(leaderboard *lb, int order, uint32_t id) {
+    uint32_t *ids = lb->order[order];
+    uint32_t rank = lb->entries[id].rank[order];
+    while (rank > 0 && ranks_above(lb, order, id, ids[rank - 1])) {
+        swap_ranks(lb, order, rank - 1);
+        rank--;
+    }
+    while (rank + 1 < lb->h->count &&
+           ranks_above(lb, order, ids[rank + 1], id)) {
+        swap_ranks(lb, order, rank);
+        rank++;
+    }
+}
+
+int leaderboard_update(leaderboard *lb, const char *player, const stats *s) {
+    if (!lb->writable || strlen(player) >= LB_PLAYER_MAX)
+        return -1;
+
+    int found;
+    uint32_t at = search(lb, player, &found);
+    if (!found && lb->h->count == lb->h->cap &&
+        rewrite(lb, lb->h->cap * 2) != 0)
+        return -1;
+
+    lb->h->dirty = 1;
+    uint32_t id;
+    if (found) {
+        id = lb->by_name[at];
+    } else {
+        // New players take the next slot, so no other id changes, and start
+        // at the bottom of each order
+        id = lb->h->count;
+        memmove(&lb->by_name[at + 1], &lb->by_name[at],
+                sizeof(uint32_t) * (lb->h->count - at));
+        lb->by_name[at] = id;
+
+        leaderboard_entry *e = &lb->entries[id];
+        memset(e, 0, sizeof(*e));
+        strcpy(e->player, player);
+        for (int o = 0; o < LB_NUM_ORDERS; o++) {
+            lb->order[o][id] = id;
+            e->rank[o] = id;
+        }
+        lb->h->count++;
+    }
+
+    leaderboard_entry *e = &lb->entries[id];
+    e->score[LB_BEST_WPM] = s->total.best_wpm;
+    e->score[LB_AVG_WPM] =
+        calc_wpm(s->total.total_keystrokes, s->total.time_spent);
+    e->score[LB_ACCURACY] =
+        calc_acc(s->total.total_keystrokes, s->total.correct_keystrokes);
+    e->games_played = s->total.games_played;
+
+    for (int o = 0; o < LB_NUM_ORDERS; o++)
+        reposition(lb, o, id);
+    lb->h->dirty = 0;
+    return 0;
+}
+
+const leaderboard_entry *leaderboard_find(const leaderboard *lb,
+                                          const char *player) {
+    int found;
+    uint32_t at = search(lb, player, &found);
+    return found ? &lb->entries[lb->by_name[at]] : NULL;
+}
+
+const leaderboard_entry *leaderboard_at(const leaderboard *lb, int order,
+                                        uint32_t rank) {
+    if (rank >= lb->h->count)
+        return NULL;
+    return &lb->entries[lb->order[order][rank]];
+}
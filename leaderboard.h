@@ -0,0 +1,78 @@
+#pragma once
+#include <stdint.h>
+
+#include "stats.h"
+
+// Leaderboard index, stats/leaderboard.bin (native byte order):
+//
+//   header        "NTLB" + uint32 version, count, cap, dirty, pad
+//   entries       leaderboard_entry[cap], in the order players joined
+//   names         uint32 by_name[cap], entry ids sorted by player name
+//   orders        uint32 order[LB_NUM_ORDERS][cap], entry ids from best to
+//                 worst by best wpm, average wpm and accuracy
+//
+// Only the first count slots of each array are used. The index is mapped
+// shared and updated in place: a player is found by a binary search over the
+// names, and a new score only moves the ids between the old and new ranks,
+// so a save writes back the pages it touched rather than the whole file.
+// Every entry also stores its rank in each order, so a player is ranked in
+// constant time. dirty is set while an update is under way; an index left
+// dirty by a crash is invalid and rebuilt from the players' stats.
+
+#define LEADERBOARD_MAGIC "NTLB"
+#define LEADERBOARD_VERSION 2
+#define LB_PLAYER_MAX 64
+#define LB_MIN_CAP 64
+
+enum { LB_BEST_WPM, LB_AVG_WPM, LB_ACCURACY, LB_NUM_ORDERS };
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t count;
+    uint32_t cap;
+    uint32_t dirty;
+    uint32_t pad;
+} leaderboard_header;
+
+typedef struct {
+    char player[LB_PLAYER_MAX];
+    double score[LB_NUM_ORDERS]; // best wpm, average wpm, accuracy
+    int32_t games_played;
+    uint32_t rank[LB_NUM_ORDERS]; // 0 is the best
+} leaderboard_entry;
+
+typedef struct {
+    char filename[256];
+    int fd;
+    int writable;
+    size_t size;
+    void *data;
+    leaderboard_header *h;
+    leaderboard_entry *entries;
+    uint32_t *by_name;
+    uint32_t *order[LB_NUM_ORDERS];
+} leaderboard;
+
+// Map the index, writable to update it in place
+// Returns 1 if opened, 0 if there is no index, -1 if it is invalid
+int leaderboard_open(const char *filename, int writable, leaderboard *lb);
+
+// Replace the index with an empty one and open it writable
+// Returns 0 on success, -1 on failure
+int leaderboard_create(const char *filename, leaderboard *lb);
+
+// Add or move a player, only shifting the ids between its old and new ranks;
+// the index is copied to one twice as large when it is full
+// Returns 0 on success, -1 on failure
+int leaderboard_update(leaderboard *lb, const char *player, const stats *s);
+
+// Returns NULL if the player is not on the leaderboard
+const leaderboard_entry *leaderboard_find(const leaderboard *lb,
+                                          const char *player);
+
+// Entry at a rank of an order, NULL past the last player
+const leaderboard_entry *leaderboard_at(const leaderboard *lb, int order,
+                                        uint32_t rank);
+
+void leaderboard_close(leaderboard *lb);
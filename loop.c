@@ -0,0 +1,171 @@
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "loop.h"
+#include "timing.h"
+#include "trace.h"
+
+enum { FD_INPUT, FD_SIGNAL, FD_DEADLINE, FD_GHOST, FD_TICK, NUM_FDS };
+
+static void loop_signals(sigset_t *set) {
+    sigemptyset(set);
+    sigaddset(set, SIGWINCH);
+    sigaddset(set, SIGINT);
+    sigaddset(set, SIGTERM);
+}
+
+static void ns_to_timespec(int64_t ns, struct timespec *ts) {
+    ts->tv_sec = ns / NS_PER_SEC;
+    ts->tv_nsec = ns % NS_PER_SEC;
+}
+
+static int open_timer(int64_t first_ns, int64_t interval_ns, int flags) {
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0) {
+        perror("timerfd_create");
+        return -1;
+    }
+    struct itimerspec its;
+    ns_to_timespec(first_ns, &its.it_value);
+    ns_to_timespec(interval_ns, &its.it_interval);
+    if (timerfd_settime(fd, flags, &its, NULL) != 0) {
+        perror("timerfd_settime");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int loop_init(game_loop *l, int hud, int64_t deadline_ns) {
+    l->tick_fd = -1;
+    l->deadline_fd = -1;
+    l->ghost_fd = -1;
+    l->signal_fd = -1;
+
+    // Signals are only read from the signalfd while the loop is open
+    sigset_t set;
+    loop_signals(&set);
+    if (sigprocmask(SIG_BLOCK, &set, NULL) != 0) {
+        perror("sigprocmask");
+        return -1;
+    }
+    l->signal_fd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (l->signal_fd < 0) {
+        perror("signalfd");
+        loop_free(l);
+        return -1;
+    }
+
+    int64_t period_ns = NS_PER_SEC / HUD_REFRESH_HZ;
+    if (hud) {
+        l->tick_fd = open_timer(period_ns, period_ns, 0);
+        if (l->tick_fd < 0) {
+            loop_free(l);
+            return -1;
+        }
+    }
+    if (deadline_ns > 0) {
+        l->deadline_fd = open_timer(deadline_ns, 0, TFD_TIMER_ABSTIME);
+        if (l->deadline_fd < 0) {
+            loop_free(l);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int loop_schedule_ghost(game_loop *l, int64_t at_ns) {
+    if (l->ghost_fd < 0) {
+        l->ghost_fd = open_timer(at_ns, 0, TFD_TIMER_ABSTIME);
+        return l->ghost_fd < 0 ? -1 : 0;
+    }
+    struct itimerspec its = {0};
+    ns_to_timespec(at_ns, &its.it_value);
+    if (timerfd_settime(l->ghost_fd, TFD_TIMER_ABSTIME, &its, NULL) != 0) {
+        perror("timerfd_settime");
+        return -1;
+    }
+    return 0;
+}
+
+// Returns 1 if the timer has expired since it was last drained
+static int drain_timer(int fd) {
+    uint64_t expirations;
+    return read(fd, &expirations, sizeof(expirations)) ==
+           (ssize_t)sizeof(expirations);
+}
+
+loop_event loop_wait(game_loop *l, char *key, int64_t *key_ns) {
+    struct pollfd fds[NUM_FDS] = {
+        [FD_INPUT] = {STDIN_FILENO, POLLIN, 0},
+        [FD_SIGNAL] = {l->signal_fd, POLLIN, 0},
+        [FD_DEADLINE] = {l->deadline_fd, POLLIN, 0},
+        [FD_GHOST] = {l->ghost_fd, POLLIN, 0},
+        [FD_TICK] = {l->tick_fd, POLLIN, 0},
+    };
+
+    for (;;) {
+        if (poll(fds, NUM_FDS, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            return LOOP_ERROR;
+        }
+
+        // Read input, timestamped as soon as it arrives
+        if (fds[FD_INPUT].revents) {
+            int64_t read_ns = trace_begin();
+            ssize_t n = read(STDIN_FILENO, key, 1);
+            *key_ns = now_ns();
+            if (n == 1) {
+                if (trace_on)
+                    trace_span(TRACE_INPUT, read_ns, *key_ns,
+                               (unsigned char)*key);
+                return LOOP_KEY;
+            }
+            if (n < 0 && (errno == EINTR || errno == EAGAIN))
+                continue;
+            return LOOP_EOF;
+        }
+
+        if (fds[FD_SIGNAL].revents) {
+            struct signalfd_siginfo si;
+            if (read(l->signal_fd, &si, sizeof(si)) == (ssize_t)sizeof(si))
+                return si.ssi_signo == SIGWINCH ? LOOP_RESIZE : LOOP_QUIT;
+        }
+
+        if (fds[FD_DEADLINE].revents && drain_timer(l->deadline_fd))
+            return LOOP_DEADLINE;
+
+        if (fds[FD_GHOST].revents && drain_timer(l->ghost_fd))
+            return LOOP_GHOST;
+
+        if (fds[FD_TICK].revents && drain_timer(l->tick_fd))
+            return LOOP_TICK;
+    }
+}
+
+void loop_free(game_loop *l) {
+    if (l->tick_fd >= 0)
+        close(l->tick_fd);
+    if (l->deadline_fd >= 0)
+        close(l->deadline_fd);
+    if (l->ghost_fd >= 0)
+        close(l->ghost_fd);
+    if (l->signal_fd >= 0)
+        close(l->signal_fd);
+    l->tick_fd = -1;
+    l->deadline_fd = -1;
+    l->ghost_fd = -1;
+    l->signal_fd = -1;
+
+    sigset_t set;
+    loop_signals(&set);
+    sigprocmask(SIG_UNBLOCK, &set, NULL);
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <stdint.h>
+
+// Event loop of the game: waits on the terminal input, a timerfd that ticks
+// at HUD_REFRESH_HZ for the live readout, a one-shot timerfd for the end of
+// a timed test, a one-shot timerfd for the next move of a ghost and a
+// signalfd for SIGWINCH, SIGINT and SIGTERM, which are blocked while the loop
+// is open.
+
+#define HUD_REFRESH_HZ 10
+
+typedef enum {
+    LOOP_KEY,      // one byte of input
+    LOOP_TICK,     // time to refresh the HUD
+    LOOP_DEADLINE, // the time of a timed test is up
+    LOOP_GHOST,    // the ghost is due to move
+    LOOP_RESIZE,   // the terminal changed size
+    LOOP_QUIT,     // SIGINT or SIGTERM
+    LOOP_EOF,      // input closed
+    LOOP_ERROR,
+} loop_event;
+
+typedef struct {
+    int tick_fd;     // -1 without a HUD
+    int deadline_fd; // -1 for an untimed test
+    int ghost_fd;    // -1 until a ghost move is scheduled
+    int signal_fd;
+} game_loop;
+
+// Start the loop, ticking only if hud is set; deadline_ns is a time on the
+// monotonic clock or 0 for an untimed test
+// Returns 0 on success, -1 on failure
+int loop_init(game_loop *l, int hud, int64_t deadline_ns);
+
+// Schedule LOOP_GHOST at at_ns on the monotonic clock, replacing any move
+// scheduled before
+// Returns 0 on success, -1 on failure
+int loop_schedule_ghost(game_loop *l, int64_t at_ns);
+
+// Wait for the next event; input always goes before the timers so a tick
+// never delays a keystroke
+loop_event loop_wait(game_loop *l, char *key, int64_t *key_ns);
+
+// Close the descriptors and unblock the signals again
+void loop_free(game_loop *l);
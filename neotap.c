@@ -1,18 +1,37 @@
+#include <errno.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
-#include <sys/time.h>
+#include <sys/stat.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "adaptive.h"
+#include "arena.h"
+#include "daemon.h"
+#include "game.h"
+#include "ghost.h"
+#include "journal.h"
+#include "loop.h"
 #include "parse_args.h"
 #include "parse_words.h"
+#include "passage.h"
+#include "render.h"
 #include "stats.h"
+#include "timing.h"
+#include "trace.h"
+#include "utf8.h"
+#include "window.h"
+
+#define TIMED_WORDS_PER_SEC 4 // words built for a timed test, 240 wpm
 
 static struct termios old;
+static journal game_journal = {.fd = -1};
+static volatile sig_atomic_t saving; // results of the game are being written
 
 static int get_terminal_width(void) {
     struct winsize w;
@@ -21,10 +40,11 @@ static int get_terminal_width(void) {
     return w.ws_col;
 }
 
-static int build_test_text(char **words, size_t num_words, char *output,
+static int build_test_text(const word_corpus *words,
+                           const adaptive_sampler *sampler, char *output,
                            size_t output_size, size_t num_test_words,
                            int term_width) {
-    if (!words || !output || output_size == 0 || num_words == 0)
+    if (!words || !output || output_size == 0 || words->count == 0)
         return 0;
 
     size_t current_idx = 0;
@@ -32,18 +52,19 @@ static int build_test_text(char **words, size_t num_words, char *output,
     int nbr_lines = 1; // start with first line
 
     for (size_t i = 0; i < num_test_words; i++) {
-        int word_idx = rand() % num_words;
-        char *word = words[word_idx];
-        int word_len = strlen(word);
+        int word_idx =
+            sampler ? adaptive_sample(sampler) : rand() % words->count;
+        int word_len;
+        const char *word = corpus_word(words, word_idx, &word_len);
 
-        // Truncate word if it's too long for terminal
-        if (word_len >= term_width)
-            word_len = term_width - 1;
+        // Truncate word if it's too wide for terminal, at a char boundary
+        int word_width;
+        word_len = utf8_fit(word, word_len, term_width - 1, &word_width);
 
         // Add space if not first word
         if (i > 0) {
             // Wrap to new line if space + word exceeds terminal width
-            if (col + 1 + word_len >= term_width) {
+            if (col + 1 + word_width >= term_width) {
                 // Ensure we have space for newline
                 if (current_idx + 1 >= output_size)
                     break;
@@ -71,7 +92,7 @@ static int build_test_text(char **words, size_t num_words, char *output,
         // Copy the word
         memcpy(&output[current_idx], word, word_len);
         current_idx += word_len;
-        col += word_len;
+        col += word_width;
 
         // Wrap if word reaches terminal width exactly
         if (col >= term_width) {
@@ -93,6 +114,56 @@ static int build_test_text(char **words, size_t num_words, char *output,
     return nbr_lines;
 }
 
+// Wrap the words of a test again at a new terminal width, breaking lines the
+// way build_test_text() does
+// Returns the new text, allocated from mem, NULL on failure
+static char *wrap_test_text(const char *text, int term_width, arena *mem) {
+    // Every break adds a line break after a space
+    size_t len = strlen(text);
+    size_t breaks = 1;
+    for (size_t i = 0; i < len; i++)
+        breaks += text[i] == ' ';
+    char *output = arena_alloc(mem, len + 2 * breaks + 1);
+    if (!output)
+        return NULL;
+
+    size_t out = 0;
+    int col = 0;
+    const char *word = text;
+    for (int first = 1; *word; first = 0) {
+        while (*word == '\n')
+            word++;
+        const char *end = word;
+        while (*end && *end != ' ' && *end != '\n')
+            end++;
+        int word_len = end - word;
+        int word_width = utf8_text_width(word, word_len);
+
+        if (!first) {
+            output[out++] = ' ';
+            if (col + 1 + word_width >= term_width) {
+                output[out++] = '\n';
+                col = 0;
+            } else {
+                col += 1;
+            }
+        }
+        memcpy(output + out, word, word_len);
+        out += word_len;
+        col += word_width;
+
+        // The separator is either the next space or a line break before it
+        word = end;
+        while (*word == '\n')
+            word++;
+        if (*word != ' ')
+            break;
+        word++;
+    }
+    output[out] = '\0';
+    return output;
+}
+
 // Turn off canonical mode + echo
 static void enable_raw_mode(struct termios *old) {
     struct termios new;
@@ -107,42 +178,252 @@ static void disable_raw_mode(struct termios *old) {
     tcsetattr(STDIN_FILENO, TCSANOW, old);
 }
 
-static void handle_signal(int sig) {
-    (void)sig;              // Sig is not used
+static void quit_game(void) {
+    journal_flush(&game_journal); // recovered on the next start
+    trace_close();
     disable_raw_mode(&old); // restore terminal settings
     printf("\033[?25h\033[0 q\n");  // show cursor again + restore to block
     printf("Caught signal, exiting...\n");
     exit(1);
 }
 
-static void print_text(const char *text, int *correct_chars, int current_idx,
-                       int current_line) {
-    int len = strlen(text);
+static void handle_signal(int sig) {
+    (void)sig; // Sig is not used
+    // Let the results finish saving, the journal is removed after them
+    if (!saving)
+        quit_game();
+}
+
+// Bytes of text typed, line breaks not counted the way a ghost counts them
+static uint32_t typed_bytes(const game *g) {
+    uint32_t done = 0;
+    for (int i = 0; i < g->current_idx; i++)
+        done += g->text[i] != '\n';
+    return done;
+}
+
+// Live speed and accuracy on the row above the text, and the lead over the
+// ghost if racing one
+static void show_hud(renderer *screen, const game *g, int time_limit,
+                     const ghost *gh) {
+    int64_t now = now_ns();
+    double wpm;
+    double acc;
+    game_live(g, now, &wpm, &acc);
+
+    char line[64];
+    if (time_limit > 0) {
+        double left = time_limit - ns_to_sec(now - g->start_ns);
+        snprintf(line, sizeof(line), "%2.0fs  %.1fwpm  %.2f%%",
+                 left > 0 ? left : 0.0, wpm, acc);
+    } else {
+        snprintf(line, sizeof(line), "%.1fwpm  %.2f%%", wpm, acc);
+    }
+    if (gh) {
+        size_t len = strlen(line);
+        long lead = (long)typed_bytes(g) - (long)gh->done;
+        snprintf(line + len, sizeof(line) - len, "  ghost %+ld", lead);
+    }
+    render_hud(screen, line);
+}
 
-    printf("\033[2K\r"); // Clear line
+// Bring the screen in line with the game, the renderer only holds the lines
+// of the window
+static void draw(renderer *screen, const game *g, const text_window *w) {
+    render_frame(screen, g->correct_keystrokes_list + w->start,
+                 g->current_idx - w->start);
+}
 
-    for (int i = 0; i < current_line - 1; i++) {
-        printf("\033[1A");   // move cursor up
-        printf("\033[2K\r"); // Clear line
+// Results of a finished game, written in the background while they are
+// printed
+typedef struct {
+    const char *player_name;
+    int64_t date; // when the game was played
+    uint32_t seed;
+    const char *text; // NULL if the game can't be logged for replay
+    const event_log *events;
+    stats *game_stats;
+    stats *player_stats; // totals including the game
+} game_save;
+
+// Fill s with the player's totals from neotapd or the stats files
+static void load_player_totals(const char *player_name, stats *s) {
+    init_stats(s);
+    if (daemon_get_stats(player_name, s) == 0)
+        return;
+    if (load_stats(player_name, s) != 1) {
+        free_stats(s);
+        init_stats(s);
     }
+}
 
-    for (int i = 0; i < len; i++) {
-        if (i < current_idx) {
-            if (!correct_chars[i]) {
-                // Red for failed char, underscore if it was a space
-                if (text[i] == ' ')
-                    printf("\033[31m_\033[0m");
-                else
-                    printf("\033[31m%c\033[0m", text[i]);
-            } else {
-                printf("\033[32m%c\033[0m", text[i]); // Green for correct
-            }
-        } else {
-            printf("%c", text[i]); // Not yet typed
+static void *save_game(void *arg) {
+    game_save *save = arg;
+
+    int64_t start_ns = trace_begin();
+    save_game_history(save->player_name, save->date, save->game_stats);
+    trace_end(TRACE_SAVE_HISTORY, start_ns, 0);
+    if (save->text) {
+        start_ns = trace_begin();
+        save_game_events(save->player_name, save->date, save->seed,
+                         save->text, save->events);
+        trace_end(TRACE_SAVE_EVENTS, start_ns, 0);
+    }
+    start_ns = trace_begin();
+    save_aggregate(save->player_name, save->game_stats);
+    trace_end(TRACE_SAVE_AGGREGATE, start_ns, 0);
+
+    // neotapd merges and saves the totals if it is running
+    start_ns = trace_begin();
+    stats daemon_totals;
+    init_stats(&daemon_totals);
+    if (daemon_add_game(save->player_name, save->game_stats,
+                        &daemon_totals) != 0)
+        save_stats(save->player_name, save->player_stats);
+    free_stats(&daemon_totals);
+    trace_end(TRACE_SAVE_TOTALS, start_ns, 0);
+    return NULL;
+}
+
+// Fold a game left in the journal by an interrupted run into the stats
+static void recover_game(const char *player_name) {
+    journal_game logged;
+    int r = journal_recover(player_name, &logged);
+    if (r == 0)
+        return;
+    if (r < 0) {
+        fprintf(stderr, "Dropping unreadable journal of %s\n", player_name);
+        journal_remove(player_name);
+        return;
+    }
+
+    arena mem;
+    arena_init(&mem);
+    game g;
+    if (game_init(&g, logged.text, 0, &mem) != 0) {
+        arena_free(&mem);
+        journal_game_free(&logged);
+        return;
+    }
+    for (uint32_t i = 0; i < logged.events.len; i++)
+        game_key(&g, logged.events.events[i].key,
+                 logged.events.events[i].t_ns);
+    game_stop(&g);
+    game_finish(&g);
+
+    // Nothing typed right, nothing to keep
+    if (g.current_idx > 0) {
+        stats player_stats;
+        load_player_totals(player_name, &player_stats);
+        merge_stats(&player_stats, &g.game_stats);
+        // Filed under the day it was played, not the day it was recovered
+        game_save save = {player_name, logged.date, logged.seed,
+                          logged.text, &logged.events, &g.game_stats,
+                          &player_stats};
+        save_game(&save);
+        free_stats(&player_stats);
+        printf("Recovered interrupted game: %.1fwpm, %.2f%%\n", g.wpm,
+               g.acc);
+    }
+    journal_remove(player_name);
+
+    game_free(&g);
+    arena_free(&mem);
+    journal_game_free(&logged);
+}
+
+// Play back every game in an event log without a terminal or delays
+static int replay_games(const char *filename) {
+    events_map m;
+    if (events_open(filename, &m) != 0)
+        return 1;
+
+    int nbr_games = 0;
+    size_t offset = 0;
+    events_game logged;
+    int r;
+    while ((r = events_next_game(&m, &offset, &logged)) == 1) {
+        // Everything of one game is released together
+        arena mem;
+        arena_init(&mem);
+        char *text = arena_alloc(&mem, logged.text_len + 1);
+        if (!text) {
+            arena_free(&mem);
+            break;
         }
+        memcpy(text, logged.text, logged.text_len);
+
+        // Event times are relative to the start of the game
+        game g;
+        if (game_init(&g, text, 0, &mem) != 0) {
+            arena_free(&mem);
+            break;
+        }
+        for (uint32_t i = 0; i < logged.num_events; i++) {
+            int64_t start_ns = trace_begin();
+            game_key(&g, logged.events[i].key, logged.events[i].t_ns);
+            trace_end(TRACE_UPDATE, start_ns, logged.events[i].key);
+        }
+        // A timed test ended with text left
+        if (!game_done(&g))
+            game_stop(&g);
+        game_finish(&g);
+
+        nbr_games++;
+        printf("==== GAME %d (seed %u) ====\n", nbr_games, logged.seed);
+        printf("Time: %.9fs\n", g.elapsed_sec);
+        printf("Speed: %.1fwpm\n", g.wpm);
+        printf("Accuracy: %.2f%%\n", g.acc);
+        print_stats(&g.game_stats);
+
+        game_free(&g);
+        arena_free(&mem);
     }
+    events_close(&m);
 
-    fflush(stdout);
+    if (r < 0) {
+        fprintf(stderr, "%s: corrupt event log\n", filename);
+        return 1;
+    }
+    return 0;
+}
+
+// Print how the game compares to the player's stats, which include it
+static void report_game(const game *g, const stats *player_stats,
+                        const ghost *gh) {
+    double avg_wpm = calc_wpm(player_stats->total.total_keystrokes,
+                              player_stats->total.time_spent);
+    double wpm_diff = g->wpm - avg_wpm;
+
+    double avg_acc = calc_acc(player_stats->total.total_keystrokes,
+                              player_stats->total.correct_keystrokes);
+    double acc_diff = g->acc - avg_acc;
+
+    if (wpm_diff < 0) {
+        printf("Speed: %.1fwpm (\033[31m↓%.1fwpm\033[0m)\n", g->wpm,
+               wpm_diff);
+    } else {
+        printf("Speed: %.1fwpm (\033[32m↑+%.1fwpm\033[0m)\n", g->wpm,
+               wpm_diff);
+    }
+    if (acc_diff < 0) {
+        printf("Accuracy: %.2f%% (\033[31m↓%.2f%%\033[0m)\n", g->acc,
+               acc_diff);
+    } else {
+        printf("Accuracy: %.2f%% (\033[32m↑+%.2f%%\033[0m)\n", g->acc,
+               acc_diff);
+    }
+
+    if (gh) {
+        double lead = g->wpm - gh->wpm;
+        if (lead >= 0)
+            printf("You beat your ghost by \033[32m%.1fwpm\033[0m\n", lead);
+        else
+            printf("Your ghost was faster by \033[31m%.1fwpm\033[0m\n",
+                   -lead);
+    }
+
+    print_stats(player_stats);
 }
 
 int main(int argc, char *argv[]) {
@@ -150,51 +431,193 @@ int main(int argc, char *argv[]) {
     if (parse_arguments(argc, argv, &args) != 0)
         return 1;
 
+    if (args.trace_file && trace_open(args.trace_file) != 0)
+        return 1;
+
+    if (args.replay_file) {
+        int ret = replay_games(args.replay_file);
+        if (trace_close() != 0)
+            ret = 1;
+        return ret;
+    }
+
+    if (args.leaderboard)
+        return print_leaderboard(args.player_name) == 0 ? 0 : 1;
+
+    if (args.export_csv) {
+        int rows = export_key_history(args.player_name);
+        if (rows < 0)
+            return 1;
+        printf("Exported %d keystrokes to stats/%s.key-history.export.csv\n",
+               rows, args.player_name);
+        return 0;
+    }
+
+    if (args.compact_days >= 0) {
+        long dropped = compact_key_history(args.player_name, args.compact_days);
+        if (dropped < 0)
+            return 1;
+        printf("Dropped %ld keystrokes older than %d days\n", dropped,
+               args.compact_days);
+        return 0;
+    }
+
     // Catch termination signals and exit gracefully
     signal(SIGINT, handle_signal);
     signal(SIGTERM, handle_signal);
 
-    // Seed the random generator
-    srand(time(NULL));
-
-    char **words = NULL;
-    int word_count = read_words(args.words_file, &words);
-    if (word_count < 0) {
+    recover_game(args.player_name);
+
+    // Seed the random generator, the seed is logged with the game
+    unsigned int seed = time(NULL);
+    srand(seed);
+
+    // The text and everything the game records live in one arena
+    static arena game_mem;
+    arena_init(&game_mem);
+    // Counters of the word corpus, kept for --alloc-stats after it is freed
+    arena corpus_mem;
+    arena_init(&corpus_mem);
+
+    int term_width = get_terminal_width();
+    char *word_text = NULL;
+    const char *text;
+    int nbr_lines;
+
+    // A passage is streamed a window of lines at a time
+    static passage stream;
+    int streaming = args.passage_file != NULL;
+    // A race is typed on the text of the ghost's game
+    ghost race;
+    ghost *gh = NULL;
+    if (streaming && args.ghost) {
+        fprintf(stderr, "Passages are not logged, so they can't be raced\n");
         return 1;
     }
+    if (streaming) {
+        if (passage_open(&stream, args.passage_file, term_width) != 0)
+            return 1;
+        text = stream.text;
+        nbr_lines = stream.num_lines;
+    } else if (args.ghost) {
+        if (ghost_load(args.player_name, args.ghost, &race, &game_mem) != 0)
+            return 1;
+        gh = &race;
+        word_text = wrap_test_text(race.text, term_width, &game_mem);
+        if (!word_text)
+            return 1;
+        text = word_text;
+        nbr_lines = 1;
+        for (const char *c = text; *c; c++)
+            nbr_lines += *c == '\n';
+        // The race is logged as the same text again
+        seed = race.seed;
+        printf("Racing game %d: %.1fwpm, %.2f%%\n", race.number, race.wpm,
+               race.acc);
+    } else {
+        int64_t load_ns = trace_begin();
+        word_corpus all_words;
+        if (read_words(args.words_file, &all_words) < 0) {
+            return 1;
+        }
 
-    char text[1000];
+        // Drills draw from the words that pass the key and length filters
+        word_filter filter;
+        word_filter_init(&filter, args.include_keys, args.only_keys,
+                         args.min_length, args.max_length);
+        word_corpus words = all_words;
+        if (!word_filter_is_open(&filter)) {
+            if (corpus_filter(&all_words, &filter, &words) < 0) {
+                free_words(&all_words);
+                return 1;
+            }
+            if (words.count == 0) {
+                fprintf(stderr, "No words in %s match the filters\n",
+                        args.words_file);
+                free_words(&words);
+                free_words(&all_words);
+                return 1;
+            }
+        }
+        trace_end(TRACE_LOAD_WORDS, load_ns, words.count);
+
+        // Weight words by the player's weak keys and digraphs
+        adaptive_sampler sampler;
+        adaptive_sampler *picker = NULL;
+        if (args.adaptive && words.count > 0) {
+            // A failed load leaves no half filled stats to weigh words by
+            stats known_stats;
+            load_player_totals(args.player_name, &known_stats);
+            static aggregate agg;
+            int have_agg = load_aggregate(args.player_name, &agg);
+
+            // The sampler is kept for the next game of this player
+            char filename[256];
+            snprintf(filename, sizeof(filename), "stats/%s.adaptive.bin",
+                     args.player_name);
+            struct stat words_st;
+            if (stat(args.words_file, &words_st) == 0 &&
+                adaptive_open(&sampler, filename, &words, &words_st, &filter,
+                              &known_stats, have_agg ? &agg : NULL) == 0)
+                picker = &sampler;
+            free_stats(&known_stats);
+        }
 
-    int nbr_lines = build_test_text(words, word_count, text, sizeof(text),
-                                    args.num_words, get_terminal_width());
-    int current_line = 1;
-    int current_idx = 0;
-    int col = 0;
+        // Room for every word at full width plus its line break
+        size_t num_words = args.num_words > 0 ? args.num_words : 0;
+        // A timed test must not run out of words
+        if (num_words < (size_t)args.time_limit * TIMED_WORDS_PER_SEC)
+            num_words = (size_t)args.time_limit * TIMED_WORDS_PER_SEC;
+        size_t text_size = num_words * (UTF8_MAX_BYTES * term_width + 3) + 1;
+        word_text = arena_alloc(&game_mem, text_size);
+        if (!word_text)
+            return 1;
+        int64_t build_ns = trace_begin();
+        nbr_lines = build_test_text(&words, picker, word_text, text_size,
+                                    num_words, term_width);
+        trace_end(TRACE_BUILD_TEXT, build_ns, nbr_lines);
+        text = word_text;
+        if (picker)
+            adaptive_free(picker);
+        corpus_mem = all_words.mem;
+        if (words.shares_data) {
+            corpus_mem.num_allocs += words.mem.num_allocs;
+            corpus_mem.num_chunks += words.mem.num_chunks;
+            corpus_mem.bytes_used += words.mem.bytes_used;
+            corpus_mem.bytes_reserved += words.mem.bytes_reserved;
+            free_words(&words);
+        }
+        corpus_mem.chunks = NULL;
+        free_words(&all_words);
+    }
+
+    // Word tests only show the lines around the cursor, like passages
+    text_window win;
+    memset(&win, 0, sizeof(win));
+    const char *shown = text;
+    if (!streaming) {
+        if (window_set_text(&win, text, 0) != 0)
+            return 1;
+        shown = win.shown;
+        nbr_lines = window_rows(&win);
+    }
 
-    int text_len = strlen(text);
+    // Everything from here is released at fail if the game can't start
+    game g;
+    memset(&g, 0, sizeof(g));
+    game_loop loop = {.tick_fd = -1, .deadline_fd = -1, .ghost_fd = -1,
+                      .signal_fd = -1};
+    renderer screen;
+    memset(&screen, 0, sizeof(screen));
 
     // Save terminal mode
     enable_raw_mode(&old);
 
-    // Keep track of correct keystrokes for text
-    int *correct_keystrokes_list = calloc(text_len, sizeof(int));
-    if (!correct_keystrokes_list) {
-        perror("calloc failed");
-        return 1;
-    }
-    for (int i = 0; i < text_len; i++) {
-        correct_keystrokes_list[i] = 1; // initialize with 1
-    }
-
-    // Init stats for this game
-    stats game_stats;
-    init_stats(&game_stats);
-
     // Count down
     printf("\033[?25l"); // hide cursor
-    for (int i = 3; i > 0; i--) {
+    for (int i = args.no_countdown ? 0 : 3; i > 0; i--) {
         printf("Game starts in: %d\n\033[90m%s\033[0m", i,
-               text); // print the text in gray
+               shown); // print the text in gray
         fflush(stdout);
         usleep(1000000);
         for (int i = 0; i < nbr_lines; i++) {
@@ -207,121 +630,190 @@ int main(int argc, char *argv[]) {
     printf("\033[6 q"); // bar cursor
 
     // Initial display
-    printf("GO!\n%s", text);
+    printf("GO!\n%s", shown);
+    fflush(stdout);
     tcflush(STDIN_FILENO, TCIFLUSH); // Clear pending input
 
-    // Start timer
-    struct timeval start, end, key_timer_start, key_timer_end;
-    gettimeofday(&start, NULL);
-    gettimeofday(&key_timer_start, NULL);
-
-    while (current_idx < text_len) {
-        // Continue on line break
-        if (text[current_idx] == '\n') {
-            current_line++;
-            col = 0; // for cursor position
-            current_idx++;
-            continue;
-        }
-
-        // Move cursor to current line
-        for (int i = 0; i < nbr_lines - current_line; i++) {
-            printf("\033[1A");
-        }
-        // Move cursor to current col
-        printf("\033[%dG", col + 1);
+    // Start timer, a timed test ends at the deadline with text left
+    int64_t start_ns = now_ns();
+    if (game_init(&g, text, start_ns, &game_mem) != 0)
+        goto fail;
+    if (loop_init(&loop, !args.no_hud,
+                  args.time_limit > 0 ? start_ns + args.time_limit * NS_PER_SEC
+                                      : 0) != 0)
+        goto fail;
+
+    // A passage is not kept in memory, so only word tests are journaled
+    if (!streaming)
+        journal_open(&game_journal, args.player_name, time(NULL), seed, text);
+
+    // From here on the screen is only updated through the renderer
+    if (render_init(&screen, shown) != 0)
+        goto fail;
+    if (gh) {
+        render_ghost(&screen, window_index(&win, ghost_index(gh, text)));
+        if (ghost_next_ns(gh) >= 0 &&
+            loop_schedule_ghost(&loop, start_ns + ghost_next_ns(gh)) != 0)
+            goto fail;
+    }
+    draw(&screen, &g, &win);
 
-        // Read input
+    int playing = 1;
+    while (playing && !game_done(&g)) {
         char input;
-        scanf("%c", &input);
-
-        if (input == text[current_idx]) {
-            // Stop and start new key timer
-            gettimeofday(&key_timer_end, NULL);
-            double elapsed_sec_for_key =
-                (key_timer_end.tv_sec - key_timer_start.tv_sec) +
-                (key_timer_end.tv_usec - key_timer_start.tv_usec) / 1e6;
-            gettimeofday(&key_timer_start, NULL);
-
-            // Add success or fail for key
-            char prev_key = '\0'; // default
-            if (current_idx > 0) {
-                prev_key = text[current_idx - 1];
+        int64_t input_ns;
+        switch (loop_wait(&loop, &input, &input_ns)) {
+        case LOOP_KEY: {
+            int64_t update_ns = trace_begin();
+            game_key(&g, input, input_ns);
+            journal_add(&game_journal, &g.events);
+            trace_end(TRACE_UPDATE, update_ns, (unsigned char)input);
+
+            // Scroll once the top line on screen has been typed
+            if (streaming && g.current_idx >= stream.line_len[0] &&
+                passage_has_more(&stream)) {
+                int dropped = passage_scroll(&stream);
+                if (game_scroll(&g, dropped) != 0 ||
+                    render_set_text(&screen, stream.text) != 0)
+                    playing = 0;
+            } else if (!streaming) {
+                int moved = window_follow(&win, g.current_idx);
+                if (moved < 0 ||
+                    (moved && render_set_text(&screen, win.shown) != 0))
+                    playing = 0;
+                if (moved > 0 && gh)
+                    render_ghost(&screen,
+                                 window_index(&win, ghost_index(gh, text)));
             }
-            update_key_stats(&game_stats, input,
-                             correct_keystrokes_list[current_idx],
-                             elapsed_sec_for_key, prev_key);
-
-            current_idx++;
-            col++;
-        } else {
-            correct_keystrokes_list[current_idx] = 0;
+            int64_t render_ns = trace_begin();
+            draw(&screen, &g, &win);
+            trace_end(TRACE_RENDER, render_ns, 0);
+            // The whole keystroke starts when the key was read
+            trace_end(TRACE_KEYSTROKE, input_ns, (unsigned char)input);
+            break;
         }
-
-        print_text(text, correct_keystrokes_list, current_idx, current_line);
-    }
-
-    // Stop timer
-    gettimeofday(&end, NULL);
-    double game_elapsed_sec =
-        (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
-
-    // Calculate wpm
-    double game_wpm = calc_wpm(text_len, game_elapsed_sec);
-
-    // Sum correct keystrokes
-    int correct_keystrokes = 0;
-    for (int i = 0; i < text_len; i++) {
-        if (correct_keystrokes_list[i] == 1) {
-            correct_keystrokes++;
+        case LOOP_TICK: {
+            int64_t hud_ns = trace_begin();
+            show_hud(&screen, &g, args.time_limit, gh);
+            draw(&screen, &g, &win);
+            trace_end(TRACE_HUD, hud_ns, 0);
+            break;
+        }
+        case LOOP_GHOST: {
+            // Only the cells the ghost leaves and lands on are redrawn
+            int64_t ghost_ns = trace_begin();
+            if (ghost_advance(gh, now_ns() - start_ns)) {
+                render_ghost(&screen,
+                             window_index(&win, ghost_index(gh, text)));
+                draw(&screen, &g, &win);
+            }
+            if (ghost_next_ns(gh) >= 0 &&
+                loop_schedule_ghost(&loop, start_ns + ghost_next_ns(gh)) != 0)
+                playing = 0;
+            trace_end(TRACE_GHOST, ghost_ns, 0);
+            break;
+        }
+        case LOOP_DEADLINE:
+            game_stop(&g);
+            playing = 0;
+            break;
+        case LOOP_RESIZE:
+            // Words are wrapped again, a passage wraps its next lines
+            term_width = get_terminal_width();
+            if (streaming) {
+                passage_set_width(&stream, term_width);
+            } else {
+                // The old text stays in the arena until the game ends
+                char *wrapped = wrap_test_text(text, term_width, &game_mem);
+                if (wrapped && game_rewrap(&g, wrapped) == 0)
+                    text = wrapped;
+                if (window_set_text(&win, text, g.current_idx) != 0) {
+                    playing = 0;
+                    break;
+                }
+            }
+            if (render_reset(&screen, streaming ? stream.text : win.shown) !=
+                0) {
+                playing = 0;
+                break;
+            }
+            if (!args.no_hud)
+                show_hud(&screen, &g, args.time_limit, gh);
+            if (gh)
+                render_ghost(&screen,
+                             window_index(&win, ghost_index(gh, text)));
+            draw(&screen, &g, &win);
+            break;
+        case LOOP_QUIT:
+            loop_free(&loop);
+            quit_game();
+            break;
+        case LOOP_EOF:
+        case LOOP_ERROR:
+            playing = 0; // input closed
+            break;
         }
     }
+    loop_free(&loop);
+    render_free(&screen);
+    window_free(&win);
+    if (streaming)
+        passage_close(&stream);
+
+    game_finish(&g);
 
     disable_raw_mode(&old);
     printf("\033[0 q"); // restore block cursor
-    free(correct_keystrokes_list);
-
-    double game_acc = calc_acc(text_len, correct_keystrokes);
 
     printf("\nDone!\n");
 
-    update_total_stats(&game_stats, text_len, correct_keystrokes,
-                       game_elapsed_sec, game_wpm);
-
-    // Load stats for player
-    stats player_stats;
-    if (!load_stats(args.player_name, &player_stats)) {
-        init_stats(&player_stats);
-    }
-
-    // Add game stats to the player
-    merge_stats(&player_stats, &game_stats);
-
-    save_game_history(args.player_name, &game_stats);
-    save_stats(args.player_name, &player_stats);
-
-    double avg_wpm = calc_wpm(player_stats.total.total_keystrokes,
-                              player_stats.total.time_spent);
-    double wpm_diff = game_wpm - avg_wpm;
-
-    double avg_acc = calc_acc(player_stats.total.total_keystrokes,
-                              player_stats.total.correct_keystrokes);
-    double acc_diff = game_acc - avg_acc;
-
-    if (wpm_diff < 0) {
-        printf("Speed: %.1fwpm (\033[31m↓%.1fwpm\033[0m)\n", game_wpm,
-               wpm_diff);
+    // Nothing typed right, nothing to keep, as for a recovered game
+    if (g.current_idx > 0) {
+        stats player_stats;
+        load_player_totals(args.player_name, &player_stats);
+        merge_stats(&player_stats, &g.game_stats);
+
+        // Write the results in the background while they are printed
+        game_save save = {args.player_name, time(NULL), seed,
+                          streaming ? NULL : text, &g.events, &g.game_stats,
+                          &player_stats};
+        saving = 1;
+        pthread_t writer;
+        int threaded = pthread_create(&writer, NULL, save_game, &save) == 0;
+        if (!threaded)
+            save_game(&save);
+
+        report_game(&g, &player_stats, gh);
+
+        if (threaded)
+            pthread_join(writer, NULL);
+        free_stats(&player_stats);
     } else {
-        printf("Speed: %.1fwpm (\033[32m↑+%.1fwpm\033[0m)\n", game_wpm,
-               wpm_diff);
-    }
-    if (acc_diff < 0) {
-        printf("Accuracy: %.2f%% (\033[31m↓%.2f%%\033[0m)\n", game_acc,
-               acc_diff);
-    } else {
-        printf("Accuracy: %.2f%% (\033[32m↑+%.2f%%\033[0m)\n", game_acc,
-               acc_diff);
+        printf("Nothing typed, the game is not saved\n");
     }
+    journal_close(&game_journal, 1);
 
-    print_stats(&player_stats);
+    game_free(&g);
+    if (args.alloc_stats) {
+        arena_print_stats(&game_mem, "game");
+        if (!streaming && !gh)
+            arena_print_stats(&corpus_mem, "corpus");
+    }
+    arena_free(&game_mem);
+    return trace_close() == 0 ? 0 : 1;
+
+fail:
+    // The game never started, so there is nothing to keep
+    loop_free(&loop);
+    render_free(&screen);
+    window_free(&win);
+    if (streaming)
+        passage_close(&stream);
+    game_free(&g);
+    journal_close(&game_journal, 1);
+    disable_raw_mode(&old);
+    printf("\033[0 q\n"); // restore block cursor
+    arena_free(&game_mem);
+    trace_close();
+    return 1;
 }
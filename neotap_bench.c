@@ -0,0 +1,243 @@
+#include <dirent.h>
+#include <limits.h>
+#include <poll.h>
+#include <pty.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "timing.h"
+
+#define MAX_KEYSTROKES 4096
+#define FRAME_TIMEOUT_MS 20 // a keystroke without output after this has none
+#define QUIET_MS 100        // output pause that ends the start screen
+
+// One synthetic typing session
+typedef struct {
+    const char *name;
+    const char *word;
+    int num_words;
+    int cols;
+    int error_every; // type a wrong key before every Nth key, 0 for never
+} scenario;
+
+static const scenario scenarios[] = {
+    {"perfect", "typing", 30, 80, 0},
+    {"errors", "typing", 30, 80, 3},
+    {"long", "typing", 140, 80, 0},
+    {"narrow", "typing", 30, 20, 0},
+    {"wide", "typing", 60, 200, 0},
+};
+
+typedef struct {
+    int64_t latency_ns[MAX_KEYSTROKES];
+    int frames;
+    int keystrokes;
+    long bytes;
+    double cpu_sec;
+} result;
+
+static int by_value(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Read whatever the game writes within timeout_ms into buf, if given
+// Returns bytes read, 0 on timeout, -1 once the game has exited
+static long read_output(int fd, int timeout_ms, char *buf, size_t size) {
+    struct pollfd p = {fd, POLLIN, 0};
+    if (poll(&p, 1, timeout_ms) <= 0)
+        return 0;
+
+    char discard[4096];
+    if (!buf) {
+        buf = discard;
+        size = sizeof(discard);
+    }
+    ssize_t n = read(fd, buf, size);
+    return n <= 0 ? -1 : n;
+}
+
+// Wait for the start screen to end, leaving the game waiting for input
+static int wait_for_start(int fd) {
+    // Keep the end of the previous read in case "GO!" is split across reads
+    char buf[4096 + 2] = {0};
+    int started = 0;
+    for (;;) {
+        long n = read_output(fd, started ? QUIET_MS : 5000, buf + 2,
+                             sizeof(buf) - 2);
+        if (n < 0)
+            return -1;
+        if (n == 0)
+            return started ? 0 : -1;
+        for (long i = 0; i + 3 <= n + 2 && !started; i++)
+            started = memcmp(buf + i, "GO!", 3) == 0;
+        memmove(buf, buf + n, 2);
+    }
+}
+
+static int run_scenario(const char *neotap, const char *dir, const scenario *s,
+                        result *res) {
+    char words_file[512];
+    snprintf(words_file, sizeof(words_file), "%s/%s.txt", dir, s->name);
+    FILE *f = fopen(words_file, "w");
+    if (!f) {
+        perror("fopen");
+        return -1;
+    }
+    fprintf(f, "%s\n", s->word);
+    fclose(f);
+
+    char num_words[16];
+    snprintf(num_words, sizeof(num_words), "%d", s->num_words);
+
+    struct winsize ws = {24, (unsigned short)s->cols, 0, 0};
+    int fd;
+    pid_t pid = forkpty(&fd, NULL, NULL, &ws);
+    if (pid < 0) {
+        perror("forkpty");
+        return -1;
+    }
+    if (pid == 0) {
+        if (chdir(dir) != 0)
+            _exit(127);
+        execl(neotap, neotap, "-p", "bench", "-f", words_file, "-w",
+              num_words, "--no-countdown", "--no-hud", (char *)NULL);
+        _exit(127);
+    }
+
+    memset(res, 0, sizeof(*res));
+    if (wait_for_start(fd) != 0) {
+        fprintf(stderr, "%s: game did not start\n", s->name);
+        kill(pid, SIGKILL);
+    } else {
+        // With a single word corpus the text is the word repeated, and
+        // line breaks are skipped by the game, so only spaces separate words
+        size_t word_len = strlen(s->word);
+        int typed = 0;
+        for (int w = 0; w < s->num_words; w++) {
+            for (size_t i = 0; i <= word_len; i++) {
+                if (i == word_len && w == s->num_words - 1)
+                    break;
+                char key = i < word_len ? s->word[i] : ' ';
+                int wrong = s->error_every && ++typed % s->error_every == 0;
+
+                for (int k = 0; k <= wrong; k++) {
+                    char c = k < wrong ? '#' : key;
+                    if (res->keystrokes >= MAX_KEYSTROKES)
+                        break;
+
+                    int64_t sent_ns = now_ns();
+                    if (write(fd, &c, 1) != 1)
+                        break;
+                    res->keystrokes++;
+
+                    long n = read_output(fd, FRAME_TIMEOUT_MS, NULL, 0);
+                    if (n > 0) {
+                        res->latency_ns[res->frames++] = now_ns() - sent_ns;
+                        // Rest of the frame
+                        long more;
+                        while ((more = read_output(fd, 1, NULL, 0)) > 0)
+                            n += more;
+                        res->bytes += n;
+                    }
+                }
+            }
+        }
+        // Results screen
+        while (read_output(fd, 1000, NULL, 0) > 0)
+            ;
+    }
+
+    int status;
+    struct rusage ru;
+    if (wait4(pid, &status, 0, &ru) < 0) {
+        perror("wait4");
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    res->cpu_sec = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+                   ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+static double percentile_us(const result *res, int p) {
+    if (res->frames == 0)
+        return 0.0;
+    int idx = (res->frames - 1) * p / 100;
+    return res->latency_ns[idx] / 1e3;
+}
+
+// Remove a directory and the files in it
+static void remove_dir(const char *path) {
+    DIR *d = opendir(path);
+    if (!d)
+        return;
+    struct dirent *e;
+    while ((e = readdir(d))) {
+        if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0)
+            continue;
+        char child[PATH_MAX];
+        snprintf(child, sizeof(child), "%s/%s", path, e->d_name);
+        if (e->d_type == DT_DIR)
+            remove_dir(child);
+        else
+            remove(child);
+    }
+    closedir(d);
+    rmdir(path);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <path to neotap>\n", argv[0]);
+        return 1;
+    }
+    char neotap[PATH_MAX];
+    if (!realpath(argv[1], neotap)) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    // Games write their stats to a scratch directory
+    char dir[] = "/tmp/neotap-bench-XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    char stats_dir[sizeof(dir) + 8];
+    snprintf(stats_dir, sizeof(stats_dir), "%s/stats", dir);
+    mkdir(stats_dir, 0755);
+
+    printf("%-10s %6s %6s %9s %9s %9s %9s %11s %8s\n", "scenario", "keys",
+           "frames", "p50(us)", "p90(us)", "p99(us)", "max(us)", "bytes/key",
+           "cpu(ms)");
+
+    static result res;
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+        const scenario *s = &scenarios[i];
+        if (run_scenario(neotap, dir, s, &res) != 0) {
+            fprintf(stderr, "%s: game did not finish cleanly\n", s->name);
+            failed = 1;
+        }
+        qsort(res.latency_ns, res.frames, sizeof(res.latency_ns[0]),
+              by_value);
+        printf("%-10s %6d %6d %9.1f %9.1f %9.1f %9.1f %11.1f %8.2f\n",
+               s->name, res.keystrokes, res.frames, percentile_us(&res, 50),
+               percentile_us(&res, 90), percentile_us(&res, 99),
+               percentile_us(&res, 100),
+               res.keystrokes ? (double)res.bytes / res.keystrokes : 0.0,
+               res.cpu_sec * 1e3);
+    }
+
+    remove_dir(dir);
+    return failed;
+}
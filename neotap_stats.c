@@ -0,0 +1,264 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "aggregate.h"
+#include "cohort.h"
+#include "history.h"
+
+#define STATS_FILE_BASE_NAME "stats/"
+#define STATS_DIR "stats"
+#define NUM_EXTREME_DIGRAPHS 15
+#define NUM_TOP_TRIGRAMS 20
+
+typedef struct {
+    const char *player_name;
+    int all_tables;
+    int rescan;
+    int all_players;
+    int jobs;
+} stats_args;
+
+// One digraph or trigram row of a ranked report
+typedef struct {
+    char keys[4];
+    double avg_wpm;
+    uint64_t count;
+    double accuracy;
+} ngram_row;
+
+static void print_usage(const char *prog_name) {
+    fprintf(stderr,
+            "Usage: %s -p <player> [options]\n"
+            "       %s -A [options]\n\n"
+            "Options:\n"
+            "  -p, --player <name>           Name of the player\n"
+            "  -A, --all-players             Report on the key history of "
+            "every player together\n"
+            "  -j, --jobs <N>                Threads used by --all-players "
+            "(default: one per core)\n"
+            "  -a, --all                     Also print the full transition "
+            "and digraph tables\n"
+            "  -r, --rescan                  Read the whole key history "
+            "instead of the snapshot\n"
+            "  -h, --help                    Show this help message\n",
+            prog_name, prog_name);
+}
+
+static int parse_stats_arguments(int argc, char *argv[], stats_args *args) {
+    args->player_name = NULL;
+    args->all_tables = 0;
+    args->rescan = 0;
+    args->all_players = 0;
+    args->jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+    static struct option long_options[] = {
+        {"player", required_argument, 0, 'p'},
+        {"all-players", no_argument, 0, 'A'},
+        {"jobs", required_argument, 0, 'j'},
+        {"all", no_argument, 0, 'a'},
+        {"rescan", no_argument, 0, 'r'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}};
+
+    int opt;
+    int option_index = 0;
+
+    while ((opt = getopt_long(argc, argv, "p:Aj:arh", long_options,
+                              &option_index)) != -1) {
+        switch (opt) {
+        case 'p':
+            args->player_name = optarg;
+            break;
+        case 'A':
+            args->all_players = 1;
+            break;
+        case 'j':
+            args->jobs = atoi(optarg);
+            if (args->jobs < 1) {
+                fprintf(stderr, "Error: number of jobs must be positive\n");
+                return -1;
+            }
+            break;
+        case 'a':
+            args->all_tables = 1;
+            break;
+        case 'r':
+            args->rescan = 1;
+            break;
+        case 'h':
+            print_usage(argv[0]);
+            exit(0);
+        default:
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (!args->player_name && !args->all_players) {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    return 0;
+}
+
+static ngram_row make_row(const agg_cell *c) {
+    ngram_row r = {{0}, c->wpm_sum / c->count, c->count,
+                   (double)c->correct / c->count};
+    return r;
+}
+
+static int by_wpm_desc(const void *a, const void *b) {
+    const ngram_row *x = a;
+    const ngram_row *y = b;
+    return (x->avg_wpm < y->avg_wpm) - (x->avg_wpm > y->avg_wpm);
+}
+
+static void print_per_key(const aggregate *a) {
+    printf("==== PER-KEY STATS ====\n");
+    printf("key    presses     avg_wpm  accuracy\n");
+    for (int k = 0; k < AGG_KEYS; k++) {
+        const agg_cell *c = &a->per_key[k];
+        if (c->count == 0)
+            continue;
+        ngram_row r = make_row(c);
+        printf("'%c'    %7llu  %10.2f  %8.4f\n", aggregate_key_char(k),
+               (unsigned long long)r.count, r.avg_wpm, r.accuracy);
+    }
+}
+
+static void print_transitions(const aggregate *a) {
+    // Only keys that were typed, or the table would be 95 columns wide
+    int keys[AGG_KEYS];
+    int n = 0;
+    for (int k = 0; k < AGG_KEYS; k++) {
+        if (a->per_key[k].count > 0)
+            keys[n++] = k;
+    }
+
+    printf("\n==== KEY TRANSITIONS (prevKey -> key) ====\n");
+    printf("   ");
+    for (int i = 0; i < n; i++)
+        printf("   '%c'", aggregate_key_char(keys[i]));
+    printf("\n");
+    for (int p = 0; p < AGG_KEYS; p++) {
+        uint64_t total = 0;
+        for (int i = 0; i < n; i++)
+            total += a->digraph[p][keys[i]].count;
+        if (total == 0)
+            continue;
+        printf("'%c'", aggregate_key_char(p));
+        for (int i = 0; i < n; i++)
+            printf(" %5llu", (unsigned long long)a->digraph[p][keys[i]].count);
+        printf("\n");
+    }
+}
+
+static void print_ngram_rows(const ngram_row *rows, int n) {
+    printf("prevKey key     avg_wpm  count  accuracy\n");
+    for (int i = 0; i < n; i++) {
+        printf("'%c'     %c    %10.2f  %5llu  %8.4f\n", rows[i].keys[0],
+               rows[i].keys[1], rows[i].avg_wpm,
+               (unsigned long long)rows[i].count, rows[i].accuracy);
+    }
+}
+
+static void print_digraphs(const aggregate *a, int all_tables) {
+    static ngram_row rows[AGG_KEYS * AGG_KEYS];
+    int n = 0;
+    for (int p = 0; p < AGG_KEYS; p++) {
+        for (int k = 0; k < AGG_KEYS; k++) {
+            const agg_cell *c = &a->digraph[p][k];
+            if (c->count == 0)
+                continue;
+            rows[n] = make_row(c);
+            rows[n].keys[0] = aggregate_key_char(p);
+            rows[n].keys[1] = aggregate_key_char(k);
+            n++;
+        }
+    }
+
+    if (all_tables) {
+        printf("\n==== DIGRAPH SPEED ====\n");
+        print_ngram_rows(rows, n);
+    }
+
+    qsort(rows, n, sizeof(rows[0]), by_wpm_desc);
+    int shown = n < NUM_EXTREME_DIGRAPHS ? n : NUM_EXTREME_DIGRAPHS;
+
+    printf("\n🔥 Fastest key-to-key transitions:\n");
+    print_ngram_rows(rows, shown);
+
+    // Slowest first
+    ngram_row slowest[NUM_EXTREME_DIGRAPHS];
+    for (int i = 0; i < shown; i++)
+        slowest[i] = rows[n - 1 - i];
+    printf("\n🐢 Slowest key-to-key transitions:\n");
+    print_ngram_rows(slowest, shown);
+}
+
+static void print_trigrams(const aggregate *a) {
+    static ngram_row rows[AGG_TRIGRAM_KEYS * AGG_TRIGRAM_KEYS *
+                          AGG_TRIGRAM_KEYS];
+    int n = 0;
+    for (int i = 0; i < AGG_TRIGRAM_KEYS; i++) {
+        for (int j = 0; j < AGG_TRIGRAM_KEYS; j++) {
+            for (int k = 0; k < AGG_TRIGRAM_KEYS; k++) {
+                const agg_cell *c = &a->trigram[i][j][k];
+                if (c->count == 0)
+                    continue;
+                rows[n] = make_row(c);
+                rows[n].keys[0] = aggregate_trigram_char(i);
+                rows[n].keys[1] = aggregate_trigram_char(j);
+                rows[n].keys[2] = aggregate_trigram_char(k);
+                n++;
+            }
+        }
+    }
+
+    qsort(rows, n, sizeof(rows[0]), by_wpm_desc);
+
+    printf("\n⚡ Top %d fastest trigrams:\n", NUM_TOP_TRIGRAMS);
+    printf("trigram     avg_wpm\n");
+    for (int i = 0; i < n && i < NUM_TOP_TRIGRAMS; i++)
+        printf("%s     %10.2f\n", rows[i].keys, rows[i].avg_wpm);
+}
+
+int main(int argc, char *argv[]) {
+    stats_args args;
+    if (parse_stats_arguments(argc, argv, &args) != 0)
+        return 1;
+
+    static aggregate agg;
+    uint64_t num_rows;
+
+    if (args.all_players) {
+        int num_players;
+        long rows =
+            cohort_aggregate(STATS_DIR, args.jobs, &agg, &num_players);
+        if (rows < 0)
+            return 1;
+        printf("%d players, %ld keystrokes\n\n", num_players, rows);
+    } else {
+        // The snapshot saved after every game is the same as a full scan
+        char filename[256];
+        snprintf(filename, sizeof(filename), "%s%s.aggregate.bin",
+                 STATS_FILE_BASE_NAME, args.player_name);
+        if (args.rescan || !aggregate_load(filename, &agg, &num_rows)) {
+            snprintf(filename, sizeof(filename), "%s%s.key-history.bin",
+                     STATS_FILE_BASE_NAME, args.player_name);
+            if (aggregate_rebuild(filename, &agg) < 0)
+                return 1;
+        }
+    }
+
+    print_per_key(&agg);
+    if (args.all_tables)
+        print_transitions(&agg);
+    print_digraphs(&agg, args.all_tables);
+    print_trigrams(&agg);
+
+    return 0;
+}
@@ -0,0 +1,404 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "daemon.h"
+#include "stats.h"
+#include "timing.h"
+
+// Games are answered once they are on disk, at most this long after arriving
+#define GROUP_COMMIT_NS (20 * 1000 * 1000)
+#define GROUP_COMMIT_MAX 64 // flush right away once this many are waiting
+#define LISTEN_BACKLOG 64
+
+// Totals of a player kept in memory, the history arrays are never allocated
+typedef struct {
+    char name[DAEMON_PLAYER_MAX];
+    stats s;
+    int dirty;
+
+    // Snapshot the totals were loaded from or last saved to, a neotap that
+    // could not reach the daemon may have written a newer one since
+    struct timespec snap_mtime;
+    off_t snap_size;
+} player;
+
+typedef struct {
+    int fd;
+    size_t got;  // bytes of req read so far
+    size_t sent; // bytes of reply written so far
+    daemon_request req;
+    daemon_reply reply;
+    int waiting;  // reply is held until the next flush
+    int replying; // reply is ready, waiting for room in the socket
+} client;
+
+static player *players;
+static int num_players;
+static int players_cap;
+
+static client *clients;
+static int num_clients;
+static int clients_cap;
+
+static volatile sig_atomic_t stopping;
+
+static void handle_signal(int sig) {
+    (void)sig;
+    stopping = 1;
+}
+
+static int valid_player_name(const char *name) {
+    size_t len = strnlen(name, DAEMON_PLAYER_MAX);
+    return len > 0 && len < DAEMON_PLAYER_MAX && !strchr(name, '/');
+}
+
+static void snapshot_filename(const char *name, char *filename,
+                              size_t size) {
+    snprintf(filename, size, "stats/%s.overall.bin", name);
+}
+
+// Remember the snapshot as it is on disk now
+static void note_snapshot(player *p) {
+    char filename[256];
+    snapshot_filename(p->name, filename, sizeof(filename));
+    struct stat st;
+    if (stat(filename, &st) != 0) {
+        memset(&st, 0, sizeof(st));
+    }
+    p->snap_mtime = st.st_mtim;
+    p->snap_size = st.st_size;
+}
+
+static int snapshot_changed(const player *p) {
+    char filename[256];
+    snapshot_filename(p->name, filename, sizeof(filename));
+    struct stat st;
+    if (stat(filename, &st) != 0)
+        memset(&st, 0, sizeof(st));
+    return st.st_size != p->snap_size ||
+           st.st_mtim.tv_sec != p->snap_mtime.tv_sec ||
+           st.st_mtim.tv_nsec != p->snap_mtime.tv_nsec;
+}
+
+static void load_player(player *p) {
+    memset(&p->s, 0, sizeof(p->s));
+    for (int i = 0; i < NUM_KEYS; i++)
+        p->s.per_key[i].key = FIRST_KEY + i;
+    note_snapshot(p);
+    if (load_stats(p->name, &p->s) != 1) {
+        memset(&p->s.total, 0, sizeof(p->s.total));
+        for (int i = 0; i < NUM_KEYS; i++) {
+            p->s.per_key[i].pressed = 0;
+            p->s.per_key[i].correct = 0;
+            p->s.per_key[i].time_spent = 0.0;
+        }
+    }
+}
+
+// Find a player, loading it from the stats files the first time and again
+// whenever someone else has saved its snapshot
+static player *get_player(const char *name) {
+    for (int i = 0; i < num_players; i++) {
+        if (strcmp(players[i].name, name) != 0)
+            continue;
+        // Games not yet on disk are only in memory, they go first
+        if (!players[i].dirty && snapshot_changed(&players[i]))
+            load_player(&players[i]);
+        return &players[i];
+    }
+
+    if (num_players == players_cap) {
+        int cap = players_cap ? players_cap * 2 : 16;
+        player *p = realloc(players, sizeof(player) * cap);
+        if (!p) {
+            perror("realloc failed");
+            return NULL;
+        }
+        players = p;
+        players_cap = cap;
+    }
+
+    player *p = &players[num_players];
+    memset(p, 0, sizeof(*p));
+    strcpy(p->name, name);
+    load_player(p);
+    num_players++;
+    return p;
+}
+
+static void close_client(int i) {
+    close(clients[i].fd);
+    clients[i] = clients[--num_clients];
+}
+
+// Replies can be larger than the socket buffer, the rest is sent once poll
+// says there is room
+// Returns 1 once the reply is out or the client is gone, 0 if it has to wait
+static int send_reply(client *c) {
+    const char *buf = (const char *)&c->reply;
+    c->replying = 1;
+    while (c->sent < sizeof(c->reply)) {
+        ssize_t n = send(c->fd, buf + c->sent, sizeof(c->reply) - c->sent,
+                         MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && errno == EAGAIN)
+            return 0;
+        if (n <= 0)
+            return 1;
+        c->sent += n;
+    }
+    return 1;
+}
+
+// Write every player with new games as one batch and release their replies
+static void flush(void) {
+    const char **names = malloc(sizeof(char *) * (num_players + 1));
+    stats **s = malloc(sizeof(stats *) * (num_players + 1));
+    int saved = 0;
+    if (names && s) {
+        int n = 0;
+        for (int i = 0; i < num_players; i++) {
+            if (!players[i].dirty)
+                continue;
+            names[n] = players[i].name;
+            s[n] = &players[i].s;
+            n++;
+        }
+        saved = n == 0 || save_stats_batch(names, s, n) == 0;
+    } else {
+        perror("malloc failed");
+    }
+    free(names);
+    free(s);
+
+    // Unsaved games are dropped and the clients told, so that they save
+    // the totals themselves; the players are loaded again from what they
+    // write
+    for (int i = num_players - 1; i >= 0; i--) {
+        if (!players[i].dirty)
+            continue;
+        if (saved) {
+            players[i].dirty = 0;
+            note_snapshot(&players[i]);
+        } else {
+            players[i] = players[--num_players];
+        }
+    }
+    for (int i = num_clients - 1; i >= 0; i--) {
+        if (!clients[i].waiting)
+            continue;
+        clients[i].waiting = 0;
+        if (!saved)
+            clients[i].reply.status = -1;
+        if (send_reply(&clients[i]))
+            close_client(i);
+    }
+}
+
+// Returns 1 if the reply has to wait for the next flush
+static int handle_request(client *c) {
+    daemon_request *req = &c->req;
+    memset(&c->reply, 0, sizeof(c->reply));
+    c->reply.magic = DAEMON_MAGIC;
+    c->reply.status = -1;
+
+    player *p = NULL;
+    if (req->magic == DAEMON_MAGIC && valid_player_name(req->player))
+        p = get_player(req->player);
+    if (!p)
+        return 0;
+
+    if (req->type == DAEMON_ADD_GAME) {
+        stats game;
+        if (snapshot_decode(&req->game, &game) != 0)
+            return 0;
+        merge_stats(&p->s, &game);
+        p->dirty = 1;
+        snapshot_encode(&c->reply.player, &p->s);
+        c->reply.status = 0;
+        return 1;
+    }
+    if (req->type == DAEMON_GET_STATS) {
+        snapshot_encode(&c->reply.player, &p->s);
+        c->reply.status = 0;
+    }
+    return 0;
+}
+
+static void accept_clients(int listen_fd) {
+    for (;;) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0)
+            return; // EAGAIN once the backlog is drained
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+
+        if (num_clients == clients_cap) {
+            int cap = clients_cap ? clients_cap * 2 : 16;
+            client *c = realloc(clients, sizeof(client) * cap);
+            if (!c) {
+                perror("realloc failed");
+                close(fd);
+                return;
+            }
+            clients = c;
+            clients_cap = cap;
+        }
+        client *c = &clients[num_clients++];
+        memset(c, 0, sizeof(*c));
+        c->fd = fd;
+    }
+}
+
+// Read what has arrived of a request and answer it once it is complete
+static void read_client(int i, int *num_waiting) {
+    client *c = &clients[i];
+    char *buf = (char *)&c->req;
+    ssize_t n = read(c->fd, buf + c->got, sizeof(c->req) - c->got);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN))
+        return;
+    if (n <= 0) {
+        close_client(i);
+        return;
+    }
+    c->got += n;
+    if (c->got < sizeof(c->req))
+        return;
+
+    if (handle_request(c)) {
+        c->waiting = 1;
+        (*num_waiting)++;
+        return;
+    }
+    if (send_reply(c))
+        close_client(i);
+}
+
+static int open_socket(void) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", DAEMON_SOCKET);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    // A socket nobody answers on is left over from a daemon that died
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (probe >= 0 &&
+        connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+        fprintf(stderr, "neotapd is already running on %s\n", DAEMON_SOCKET);
+        close(probe);
+        close(fd);
+        return -1;
+    }
+    if (probe >= 0)
+        close(probe);
+    unlink(DAEMON_SOCKET);
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(fd, LISTEN_BACKLOG) != 0) {
+        perror(DAEMON_SOCKET);
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    return fd;
+}
+
+int main(void) {
+    int listen_fd = open_socket();
+    if (listen_fd < 0)
+        return 1;
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+    signal(SIGPIPE, SIG_IGN);
+    printf("neotapd listening on %s\n", DAEMON_SOCKET);
+    fflush(stdout);
+
+    struct pollfd *fds = NULL;
+    int num_waiting = 0;
+    int64_t first_waiting_ns = 0;
+
+    while (!stopping) {
+        struct pollfd *p = realloc(fds, sizeof(*fds) * (num_clients + 1));
+        if (!p) {
+            perror("realloc failed");
+            break;
+        }
+        fds = p;
+        fds[0].fd = listen_fd;
+        fds[0].events = POLLIN;
+        for (int i = 0; i < num_clients; i++) {
+            fds[i + 1].fd = clients[i].fd;
+            fds[i + 1].events = POLLIN;
+            if (clients[i].replying)
+                fds[i + 1].events = POLLOUT;
+            else if (clients[i].waiting)
+                fds[i + 1].events = 0;
+        }
+
+        int timeout_ms = -1;
+        if (num_waiting > 0) {
+            int64_t left = first_waiting_ns + GROUP_COMMIT_NS - now_ns();
+            timeout_ms = left > 0 ? left / 1000000 + 1 : 0;
+        }
+        int nfds = num_clients + 1;
+        if (poll(fds, nfds, timeout_ms) < 0 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+
+        // Clients are closed by swapping in the last one, so go backwards
+        int before = num_waiting;
+        for (int i = nfds - 2; i >= 0; i--) {
+            if (!fds[i + 1].revents || clients[i].waiting)
+                continue;
+            if (!clients[i].replying)
+                read_client(i, &num_waiting);
+            else if (send_reply(&clients[i]))
+                close_client(i);
+        }
+        if (fds[0].revents & POLLIN)
+            accept_clients(listen_fd);
+
+        if (before == 0 && num_waiting > 0)
+            first_waiting_ns = now_ns();
+        if (num_waiting > 0 &&
+            (num_waiting >= GROUP_COMMIT_MAX ||
+             now_ns() - first_waiting_ns >= GROUP_COMMIT_NS)) {
+            flush();
+            num_waiting = 0;
+        }
+    }
+
+    // Finish the replies still going out, clients wait on them for at most
+    // their timeout
+    flush();
+    for (int i = num_clients - 1; i >= 0; i--) {
+        if (!clients[i].replying)
+            continue;
+        fcntl(clients[i].fd, F_SETFL, 0);
+        send_reply(&clients[i]);
+        close_client(i);
+    }
+    close(listen_fd);
+    unlink(DAEMON_SOCKET);
+    free(fds);
+    free(players);
+    free(clients);
+    return 0;
+}
@@ -0,0 +1,132 @@
+import ctypes
+import os
+from datetime import datetime
+
+import numpy as np
+import pandas as pd
+
+# Bindings for libneotapstats.so, see query.h. Results are numpy arrays over
+# the memory the library allocated, freed once the last array is gone.
+
+# Every printable key, ' ' to '~', see aggregate.h
+AGG_KEYS = 95
+AGG_KEY_CHARS = [chr(ord(" ") + k) for k in range(AGG_KEYS)]
+AGG_CELL = np.dtype([("count", "=u8"), ("correct", "=u8"), ("wpm_sum", "=f8")])
+QUERY_GAME = np.dtype([("date", "=i8"), ("num_rows", "=u4"), ("correct", "=u4"), ("wpm_sum", "=f8")])
+
+
+class _Samples(ctypes.Structure):
+    _fields_ = [
+        ("num_rows", ctypes.c_uint64),
+        ("date", ctypes.c_void_p),
+        ("wpm", ctypes.c_void_p),
+        ("key", ctypes.c_void_p),
+        ("prev_key", ctypes.c_void_p),
+        ("acc", ctypes.c_void_p),
+    ]
+
+
+_lib = ctypes.CDLL(os.path.join(os.path.dirname(os.path.abspath(__file__)), "libneotapstats.so"))
+_lib.query_key_samples.argtypes = [ctypes.c_char_p, ctypes.c_char, ctypes.POINTER(_Samples)]
+_lib.query_key_samples.restype = ctypes.c_long
+_lib.query_samples_free.argtypes = [ctypes.POINTER(_Samples)]
+_lib.query_samples_free.restype = None
+_lib.query_games.argtypes = [ctypes.c_char_p, ctypes.POINTER(ctypes.c_void_p)]
+_lib.query_games.restype = ctypes.c_long
+_lib.query_digraphs.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_void_p, ctypes.c_void_p]
+_lib.query_digraphs.restype = ctypes.c_int
+_lib.query_free.argtypes = [ctypes.c_void_p]
+_lib.query_free.restype = None
+
+
+class _Owner:
+    """Releases library memory when garbage collected."""
+
+    def __init__(self, free, *args):
+        self._free = free
+        self._args = args
+
+    def __del__(self):
+        self._free(*self._args)
+
+
+class _Column:
+    """Exposes library memory to numpy, keeping its owner alive."""
+
+    def __init__(self, owner, address, dtype, n):
+        self._owner = owner
+        self.__array_interface__ = {
+            "shape": (n,),
+            "typestr": np.dtype(dtype).str,
+            "descr": np.dtype(dtype).descr,
+            "data": (address, False),
+            "version": 3,
+        }
+
+
+def _wrap(owner, address, dtype, n):
+    if n == 0:
+        return np.empty(0, dtype=dtype)
+    return np.asarray(_Column(owner, address, dtype, n))
+
+
+def _history_path(player):
+    return f"stats/{player}.key-history.bin".encode()
+
+
+def key_samples(player, key=None):
+    """Keystrokes of one key, or of all keys, as a dict of numpy columns."""
+    q = _Samples()
+    wanted = key.encode() if key else b"\0"
+    n = _lib.query_key_samples(_history_path(player), wanted, ctypes.byref(q))
+    if n < 0:
+        raise OSError(f"could not read the key history of {player}")
+    owner = _Owner(_lib.query_samples_free, ctypes.byref(q)) if n else None
+    return {
+        "date": _wrap(owner, q.date, np.int64, n),
+        "wpm": _wrap(owner, q.wpm, np.float64, n),
+        "key": _wrap(owner, q.key, "S1", n),
+        "prevKey": _wrap(owner, q.prev_key, "S1", n),
+        "acc": _wrap(owner, q.acc, np.uint8, n),
+    }
+
+
+def games(player):
+    """One row per game: date, num_rows, correct and wpm_sum."""
+    p = ctypes.c_void_p()
+    n = _lib.query_games(_history_path(player), ctypes.byref(p))
+    if n < 0:
+        raise OSError(f"could not read the key history of {player}")
+    return _wrap(_Owner(_lib.query_free, p) if n else None, p.value, QUERY_GAME, n)
+
+
+def digraphs(player):
+    """Per-key [95] and [prevKey][key] [95, 95] tables of count, correct and wpm_sum."""
+    per_key = np.zeros(AGG_KEYS, dtype=AGG_CELL)
+    digraph = np.zeros((AGG_KEYS, AGG_KEYS), dtype=AGG_CELL)
+    if _lib.query_digraphs(f"stats/{player}.aggregate.bin".encode(), _history_path(player),
+                           per_key.ctypes.data, digraph.ctypes.data) != 0:
+        raise OSError(f"could not read the key history of {player}")
+    return per_key, digraph
+
+
+def local_datetimes(seconds):
+    """Unix times as naive local datetimes, like the dates of the old CSV files."""
+    # One conversion per game, not per keystroke
+    unique, inverse = np.unique(seconds, return_inverse=True)
+    local = np.array([datetime.fromtimestamp(int(t)) for t in unique], dtype="datetime64[s]")
+    return pd.to_datetime(local[inverse])
+
+
+def key_samples_frame(player, key=None):
+    """key_samples as a date,key,prevKey,wpm,acc DataFrame."""
+    s = key_samples(player, key)
+    prev_key = s["prevKey"].astype(str).astype(object)
+    prev_key[prev_key == ""] = np.nan
+    return pd.DataFrame({
+        "date": local_datetimes(s["date"]),
+        "key": s["key"].astype(str),
+        "prevKey": prev_key,
+        "wpm": s["wpm"],
+        "acc": s["acc"].astype(np.int64),
+    })
@@ -1,3 +1,4 @@
+#include <errno.h>
 #include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -7,6 +8,39 @@
 
 #define DEFAULT_NUM_WORDS 10
 #define DEFAULT_WORDS_FILE "words/words.txt"
+#define MAX_COMPACT_DAYS 36500
+#define MAX_TIME_LIMIT 3600 // text is built for the whole test up front
+#define MAX_WORD_LENGTH 255
+
+// Long-only options
+enum {
+    OPT_EXPORT_CSV = 256,
+    OPT_REPLAY,
+    OPT_NO_COUNTDOWN,
+    OPT_NO_HUD,
+    OPT_PASSAGE,
+    OPT_LEADERBOARD,
+    OPT_COMPACT_HISTORY,
+    OPT_INCLUDE_KEYS,
+    OPT_ONLY_KEYS,
+    OPT_MIN_LENGTH,
+    OPT_MAX_LENGTH,
+    OPT_ALLOC_STATS,
+    OPT_TRACE,
+    OPT_GHOST,
+};
+
+// Parse a whole decimal number in [min, max]
+// Returns 0 on success, -1 on failure
+static int parse_number(const char *s, long min, long max, int *out) {
+    char *end;
+    errno = 0;
+    long n = strtol(s, &end, 10);
+    if (end == s || *end != '\0' || errno == ERANGE || n < min || n > max)
+        return -1;
+    *out = n;
+    return 0;
+}
 
 static void print_usage(const char *prog_name) {
     fprintf(stderr,
@@ -16,6 +50,42 @@ static void print_usage(const char *prog_name) {
             "  -w, --num-words <N>           Number of words in the test "
             "(default: 10)\n"
             "  -f, --custom-words-file <file>  Path to custom words file\n"
+            "  -a, --adaptive                Pick words that train your "
+            "slowest and least\n"
+            "                                accurate keys\n"
+            "      --include-keys <keys>     Only use words with at least one "
+            "of these keys\n"
+            "      --only-keys <keys>        Only use words typed with just "
+            "these keys\n"
+            "      --min-length <N>          Only use words of at least N "
+            "chars, up to 255\n"
+            "      --max-length <N>          Only use words of at most N "
+            "chars, up to 255\n"
+            "  -t, --time <seconds>          End the test after this many "
+            "seconds, up to 3600\n"
+            "      --passage <file>          Type a whole text file instead "
+            "of words\n"
+            "      --ghost <game>            Race a previous game: best, last "
+            "or its\n"
+            "                                number in --replay\n"
+            "      --no-countdown            Start the game right away\n"
+            "      --no-hud                  Hide the live speed and accuracy\n"
+            "      --alloc-stats             Show the memory used by the game "
+            "after it\n"
+            "      --trace <file>            Write a Chrome trace of the "
+            "game's phases\n"
+            "      --export-csv              Write the key history as CSV "
+            "and exit\n"
+            "      --replay <log>            Replay the games in an event log "
+            "and exit\n"
+            "      --leaderboard             Show the top players, and your "
+            "ranks with -p,\n"
+            "                                and exit\n"
+            "      --compact-history <days>  Keep only the last <days> days of "
+            "raw key\n"
+            "                                history, older keystrokes stay in "
+            "the\n"
+            "                                rollups, and exit\n"
             "  -h, --help                    Show this help message\n",
             prog_name);
 }
@@ -28,19 +98,51 @@ int parse_arguments(int argc, char *argv[], args *args) {
     args->player_name = NULL;
     args->num_words = DEFAULT_NUM_WORDS;
     args->words_file = DEFAULT_WORDS_FILE;
+    args->export_csv = false;
+    args->replay_file = NULL;
+    args->no_countdown = false;
+    args->no_hud = false;
+    args->alloc_stats = false;
+    args->trace_file = NULL;
+    args->adaptive = false;
+    args->include_keys = NULL;
+    args->only_keys = NULL;
+    args->min_length = 0;
+    args->max_length = 0;
+    args->passage_file = NULL;
+    args->ghost = NULL;
+    args->leaderboard = false;
+    args->compact_days = -1;
+    args->time_limit = 0;
 
     // Define long options
     static struct option long_options[] = {
         {"player", required_argument, 0, 'p'},
         {"num-words", required_argument, 0, 'w'},
         {"custom-words-file", required_argument, 0, 'f'},
+        {"adaptive", no_argument, 0, 'a'},
+        {"time", required_argument, 0, 't'},
+        {"include-keys", required_argument, 0, OPT_INCLUDE_KEYS},
+        {"only-keys", required_argument, 0, OPT_ONLY_KEYS},
+        {"min-length", required_argument, 0, OPT_MIN_LENGTH},
+        {"max-length", required_argument, 0, OPT_MAX_LENGTH},
+        {"export-csv", no_argument, 0, OPT_EXPORT_CSV},
+        {"replay", required_argument, 0, OPT_REPLAY},
+        {"no-countdown", no_argument, 0, OPT_NO_COUNTDOWN},
+        {"no-hud", no_argument, 0, OPT_NO_HUD},
+        {"alloc-stats", no_argument, 0, OPT_ALLOC_STATS},
+        {"trace", required_argument, 0, OPT_TRACE},
+        {"passage", required_argument, 0, OPT_PASSAGE},
+        {"ghost", required_argument, 0, OPT_GHOST},
+        {"leaderboard", no_argument, 0, OPT_LEADERBOARD},
+        {"compact-history", required_argument, 0, OPT_COMPACT_HISTORY},
         {"help", no_argument, 0, 'h'},
         {0, 0, 0, 0}};
 
     int opt;
     int option_index = 0;
 
-    while ((opt = getopt_long(argc, argv, "p:w:f:h", long_options,
+    while ((opt = getopt_long(argc, argv, "p:w:f:at:h", long_options,
                               &option_index)) != -1) {
         switch (opt) {
         case 'p':
@@ -52,6 +154,70 @@ int parse_arguments(int argc, char *argv[], args *args) {
         case 'f':
             args->words_file = optarg; // string
             break;
+        case 'a':
+            args->adaptive = true;
+            break;
+        case 't':
+            if (parse_number(optarg, 1, MAX_TIME_LIMIT,
+                             &args->time_limit) != 0) {
+                print_usage(argv[0]);
+                return -1;
+            }
+            break;
+        case OPT_INCLUDE_KEYS:
+            args->include_keys = optarg;
+            break;
+        case OPT_ONLY_KEYS:
+            args->only_keys = optarg;
+            break;
+        case OPT_MIN_LENGTH:
+        case OPT_MAX_LENGTH: {
+            int len;
+            if (parse_number(optarg, 1, MAX_WORD_LENGTH, &len) != 0) {
+                print_usage(argv[0]);
+                return -1;
+            }
+            if (opt == OPT_MIN_LENGTH)
+                args->min_length = len;
+            else
+                args->max_length = len;
+            break;
+        }
+        case OPT_EXPORT_CSV:
+            args->export_csv = true;
+            break;
+        case OPT_REPLAY:
+            args->replay_file = optarg;
+            break;
+        case OPT_NO_COUNTDOWN:
+            args->no_countdown = true;
+            break;
+        case OPT_NO_HUD:
+            args->no_hud = true;
+            break;
+        case OPT_ALLOC_STATS:
+            args->alloc_stats = true;
+            break;
+        case OPT_TRACE:
+            args->trace_file = optarg;
+            break;
+        case OPT_PASSAGE:
+            args->passage_file = optarg;
+            break;
+        case OPT_GHOST:
+            args->ghost = optarg;
+            break;
+        case OPT_LEADERBOARD:
+            args->leaderboard = true;
+            break;
+        case OPT_COMPACT_HISTORY:
+            // A typo must not compact away the whole history
+            if (parse_number(optarg, 0, MAX_COMPACT_DAYS,
+                             &args->compact_days) != 0) {
+                print_usage(argv[0]);
+                return -1;
+            }
+            break;
         case 'h':
             print_usage(argv[0]);
             exit(0);
@@ -61,8 +227,16 @@ int parse_arguments(int argc, char *argv[], args *args) {
         }
     }
 
-    // Check required arguments
-    if (!args->player_name) {
+    // No word could pass the filter
+    if (args->min_length > 0 && args->max_length > 0 &&
+        args->min_length > args->max_length) {
+        fprintf(stderr, "--min-length is more than --max-length\n");
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    // Check required arguments, replaying and the leaderboard need no player
+    if (!args->player_name && !args->replay_file && !args->leaderboard) {
         print_usage(argv[0]);
         return -1;
     }
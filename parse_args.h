@@ -6,6 +6,22 @@ typedef struct {
     char *player_name;
     int num_words;
     char *words_file;
+    bool export_csv;
+    char *replay_file;
+    bool no_countdown;
+    bool no_hud;
+    bool alloc_stats;
+    char *trace_file; // NULL unless tracing
+    bool adaptive;
+    char *include_keys; // NULL for no filter
+    char *only_keys;
+    int min_length; // 0 for no limit
+    int max_length;
+    char *passage_file;
+    char *ghost; // game to race, NULL for none
+    bool leaderboard;
+    int compact_days; // -1 unless compacting the key history
+    int time_limit;   // seconds, 0 for a test that ends with its text
 } args;
 
 // Parse command-line arguments
@@ -1,60 +1,329 @@
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "parse_words.h"
+#include "utf8.h"
 
-#define MAX_WORD_LEN 100 // maximum length of each word
+// Smaller corpora are indexed faster than an index file can be checked
+#define WORD_INDEX_MIN_WORDS 65536
 
-int read_words(const char *filename, char ***words_out) {
-    FILE *fp = fopen(filename, "r");
-    if (!fp) {
-        perror("Could not open file");
+static void *map_file(int fd, size_t size) {
+    void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    return data == MAP_FAILED ? NULL : data;
+}
+
+static size_t index_size(size_t count) {
+    return sizeof(word_index_header) +
+           (sizeof(word_ref) + sizeof(key_mask) + sizeof(uint16_t)) * count;
+}
+
+// Refs, masks and lengths for count words from the corpus arena
+static int alloc_owned(word_corpus *corpus, size_t count, word_ref **refs,
+                       key_mask **masks, uint16_t **lengths) {
+    *refs = arena_alloc(&corpus->mem, sizeof(word_ref) * count);
+    *masks = arena_alloc(&corpus->mem, sizeof(key_mask) * count);
+    *lengths = arena_alloc(&corpus->mem, sizeof(uint16_t) * count);
+    if (!*refs || !*masks || !*lengths)
         return -1;
+    corpus->refs = *refs;
+    corpus->masks = *masks;
+    corpus->lengths = *lengths;
+    return 0;
+}
+
+// Use the cached index if it was built from this exact words file
+static int load_index(const char *index_filename, const struct stat *source,
+                      word_corpus *corpus) {
+    int fd = open(index_filename, O_RDONLY);
+    if (fd < 0)
+        return 0;
+
+    struct stat st;
+    void *data = NULL;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(word_index_header))
+        data = map_file(fd, st.st_size);
+    close(fd);
+    if (!data)
+        return 0;
+
+    const word_index_header *h = data;
+    if (memcmp(h->magic, WORD_INDEX_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != WORD_INDEX_VERSION ||
+        h->source_size != (uint64_t)source->st_size ||
+        h->source_mtime_sec != source->st_mtim.tv_sec ||
+        h->source_mtime_nsec != source->st_mtim.tv_nsec ||
+        (size_t)st.st_size != index_size(h->count)) {
+        munmap(data, st.st_size);
+        return 0;
     }
 
-    char buffer[MAX_WORD_LEN];
-    int count = 0;
-    int capacity = 10; // initial size
-    char **words = malloc(capacity * sizeof(char *));
-    if (!words) {
-        perror("malloc failed");
-        fclose(fp);
-        return -1;
-    }
-
-    while (fgets(buffer, sizeof(buffer), fp)) {
-        buffer[strcspn(buffer, "\n")] = '\0'; // remove newline
-
-        if (count >= capacity) {
-            capacity *= 2;
-            char **tmp = realloc(words, capacity * sizeof(char *));
-            if (!tmp) {
-                perror("realloc failed");
-                // free already allocated strings
-                for (int i = 0; i < count; i++)
-                    free(words[i]);
-                free(words);
-                fclose(fp);
-                return -1;
-            }
-            words = tmp;
+    corpus->refs = (const word_ref *)(h + 1);
+    corpus->masks = (const key_mask *)(corpus->refs + h->count);
+    corpus->lengths = (const uint16_t *)(corpus->masks + h->count);
+    corpus->count = h->count;
+    corpus->index_map = data;
+    corpus->index_map_size = st.st_size;
+    return 1;
+}
+
+// Best effort, a missing index only costs the next start a rebuild
+static void save_index(const char *index_filename, const struct stat *source,
+                       const word_corpus *corpus) {
+    char tmp_filename[512];
+    snprintf(tmp_filename, sizeof(tmp_filename), "%s.tmp", index_filename);
+
+    FILE *f = fopen(tmp_filename, "wb");
+    if (!f)
+        return;
+
+    word_index_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, WORD_INDEX_MAGIC, sizeof(h.magic));
+    h.version = WORD_INDEX_VERSION;
+    h.source_size = source->st_size;
+    h.source_mtime_sec = source->st_mtim.tv_sec;
+    h.source_mtime_nsec = source->st_mtim.tv_nsec;
+    h.count = corpus->count;
+
+    int ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+             fwrite(corpus->refs, sizeof(word_ref), corpus->count, f) ==
+                 corpus->count &&
+             fwrite(corpus->masks, sizeof(key_mask), corpus->count, f) ==
+                 corpus->count &&
+             fwrite(corpus->lengths, sizeof(uint16_t), corpus->count, f) ==
+                 corpus->count;
+    if (fclose(f) != 0)
+        ok = 0;
+    if (!ok || rename(tmp_filename, index_filename) != 0)
+        remove(tmp_filename);
+}
+
+// Chars in a word, the bytes that continue a UTF-8 char are not counted
+static uint16_t word_length(const char *s, size_t n) {
+    size_t chars = 0;
+    for (size_t i = 0; i < n; i++)
+        chars += ((unsigned char)s[i] & 0xc0) != 0x80;
+    return chars > UINT16_MAX ? UINT16_MAX : chars;
+}
+
+// Whether a word is whole UTF-8, a malformed char could never be typed
+static int valid_utf8(const char *s, size_t n) {
+    for (size_t i = 0; i < n;) {
+        if ((unsigned char)s[i] < 0x80) {
+            i++;
+            continue;
         }
+        uint32_t cp;
+        size_t left = n - i;
+        i += utf8_decode(s + i, left < UTF8_MAX_BYTES ? left : UTF8_MAX_BYTES,
+                         &cp);
+        if (cp == UTF8_INVALID)
+            return 0;
+    }
+    return 1;
+}
 
-        words[count] = strdup(buffer); // allocate + copy
-        if (!words[count]) {
-            perror("strdup failed");
-            // cleanup
-            for (int i = 0; i < count; i++)
-                free(words[i]);
-            free(words);
-            fclose(fp);
-            return -1;
+// Index every non-empty line that is valid UTF-8 with a single allocation
+static int build_index(word_corpus *corpus) {
+    const char *data = corpus->data;
+    const char *end = data + corpus->size;
+
+    size_t lines = 0;
+    for (const char *p = data; p < end; lines++) {
+        const char *nl = memchr(p, '\n', end - p);
+        p = nl ? nl + 1 : end;
+    }
+
+    word_ref *refs;
+    key_mask *masks;
+    uint16_t *lengths;
+    if (alloc_owned(corpus, lines, &refs, &masks, &lengths) != 0)
+        return -1;
+
+    size_t count = 0;
+    size_t invalid = 0;
+    for (const char *p = data; p < end;) {
+        const char *nl = memchr(p, '\n', end - p);
+        const char *line_end = nl ? nl : end;
+        size_t len = line_end - p;
+        if (len > 0 && p[len - 1] == '\r')
+            len--;
+        if (len > 0 && !valid_utf8(p, len)) {
+            invalid++;
+        } else if (len > 0) {
+            refs[count].offset = p - data;
+            refs[count].len = len;
+            key_mask_of(p, len, &masks[count]);
+            lengths[count] = word_length(p, len);
+            count++;
         }
-        count++;
+        p = line_end + (nl ? 1 : 0);
+    }
+
+    if (invalid > 0)
+        fprintf(stderr, "Ignoring %zu words that are not valid UTF-8\n",
+                invalid);
+    corpus->count = count;
+    return 0;
+}
+
+int read_words(const char *filename, word_corpus *corpus) {
+    memset(corpus, 0, sizeof(*corpus));
+    arena_init(&corpus->mem);
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror("Could not open file");
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        perror("fstat");
+        close(fd);
+        return -1;
+    }
+    if ((uint64_t)st.st_size > UINT32_MAX) {
+        fprintf(stderr, "%s: words files are limited to 4 GiB\n", filename);
+        close(fd);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    corpus->data = map_file(fd, st.st_size);
+    close(fd);
+    if (!corpus->data) {
+        perror("mmap");
+        return -1;
+    }
+    corpus->size = st.st_size;
+
+    char index_filename[512];
+    snprintf(index_filename, sizeof(index_filename), "%s.idx", filename);
+    if (load_index(index_filename, &st, corpus))
+        return corpus->count;
+
+    if (build_index(corpus) != 0) {
+        free_words(corpus);
+        return -1;
+    }
+    if (corpus->count >= WORD_INDEX_MIN_WORDS)
+        save_index(index_filename, &st, corpus);
+
+    return corpus->count;
+}
+
+void free_words(word_corpus *corpus) {
+    if (corpus->data && !corpus->shares_data)
+        munmap((void *)corpus->data, corpus->size);
+    if (corpus->index_map)
+        munmap(corpus->index_map, corpus->index_map_size);
+    arena_free(&corpus->mem);
+    memset(corpus, 0, sizeof(*corpus));
+}
+
+const char *corpus_word(const word_corpus *corpus, size_t i, int *len) {
+    *len = corpus->refs[i].len;
+    return corpus->data + corpus->refs[i].offset;
+}
+
+void key_mask_of(const char *s, size_t n, key_mask *m) {
+    m->bits[0] = 0;
+    m->bits[1] = 0;
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = s[i];
+        if (c == ' ')
+            continue; // typed between words, never filtered
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        int bit = c >= KEY_MASK_FIRST && c <= '~' ? c - KEY_MASK_FIRST
+                                                  : KEY_MASK_OTHER;
+        m->bits[bit / 64] |= (uint64_t)1 << (bit % 64);
+    }
+}
+
+void word_filter_init(word_filter *f, const char *include, const char *only,
+                      int min_len, int max_len) {
+    f->include.bits[0] = f->include.bits[1] = UINT64_MAX;
+    f->only.bits[0] = f->only.bits[1] = UINT64_MAX;
+    if (include)
+        key_mask_of(include, strlen(include), &f->include);
+    if (only)
+        key_mask_of(only, strlen(only), &f->only);
+    f->min_len = min_len > 0 ? (min_len < UINT16_MAX ? min_len : UINT16_MAX)
+                             : 0;
+    f->max_len = max_len > 0 && max_len < UINT16_MAX ? max_len : UINT16_MAX;
+}
+
+int word_filter_is_open(const word_filter *f) {
+    return f->include.bits[0] == UINT64_MAX &&
+           f->include.bits[1] == UINT64_MAX &&
+           f->only.bits[0] == UINT64_MAX && f->only.bits[1] == UINT64_MAX &&
+           f->min_len == 0 && f->max_len == UINT16_MAX;
+}
+
+int corpus_filter(const word_corpus *src, const word_filter *f,
+                  word_corpus *dest) {
+    memset(dest, 0, sizeof(*dest));
+    arena_init(&dest->mem);
+
+    uint8_t *keep = malloc(src->count ? src->count : 1);
+    if (!keep) {
+        perror("malloc failed");
+        return -1;
+    }
+
+    // Test every word without branches, so the compiler can vectorize the
+    // scan, then gather the ones that passed
+    const uint64_t not_only0 = ~f->only.bits[0];
+    const uint64_t not_only1 = ~f->only.bits[1];
+    const uint64_t include0 = f->include.bits[0];
+    const uint64_t include1 = f->include.bits[1];
+    const uint16_t min_len = f->min_len;
+    const uint16_t max_len = f->max_len;
+    const key_mask *masks_in = src->masks;
+    const uint16_t *lengths_in = src->lengths;
+    for (size_t i = 0; i < src->count; i++) {
+        uint64_t lo = masks_in[i].bits[0];
+        uint64_t hi = masks_in[i].bits[1];
+        uint64_t outside = (lo & not_only0) | (hi & not_only1);
+        uint64_t included = (lo & include0) | (hi & include1);
+        keep[i] = (outside == 0) & (included != 0) &
+                  (lengths_in[i] >= min_len) & (lengths_in[i] <= max_len);
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < src->count; i++)
+        n += keep[i];
+
+    word_ref *refs;
+    key_mask *masks;
+    uint16_t *lengths;
+    if (alloc_owned(dest, n, &refs, &masks, &lengths) != 0) {
+        free(keep);
+        arena_free(&dest->mem);
+        return -1;
+    }
+    for (size_t i = 0, j = 0; i < src->count; i++) {
+        if (!keep[i])
+            continue;
+        refs[j] = src->refs[i];
+        masks[j] = src->masks[i];
+        lengths[j] = src->lengths[i];
+        j++;
     }
+    free(keep);
 
-    fclose(fp);
-    *words_out = words; // hand back allocated array
-    return count;
-}
\ No newline at end of file
+    dest->data = src->data;
+    dest->size = src->size;
+    dest->shares_data = 1;
+    dest->count = n;
+    return n;
+}
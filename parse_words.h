@@ -1,3 +1,95 @@
 #pragma once
+#include <stddef.h>
+#include <stdint.h>
 
-int read_words(const char *filename, char ***words_out);
\ No newline at end of file
+#include "arena.h"
+
+// Cached word index, stored as "<words file>.idx" (native byte order):
+//
+//   header        "NTWI" + uint32 version, the size and mtime of the words
+//                 file it was built from and the number of words
+//   word_ref      refs[count]
+//   key_mask      masks[count]
+//   uint16        lengths[count]
+//
+// It is only used while the words file's size and mtime still match. Lines
+// that are not valid UTF-8 are left out. Version 1 had no masks or lengths,
+// version 2 kept the lines that are not UTF-8.
+
+#define WORD_INDEX_MAGIC "NTWI"
+#define WORD_INDEX_VERSION 3
+
+// Key masks have a bit for every printable ASCII char but space, with
+// letters folded to lower case, and one shared by everything else
+#define KEY_MASK_FIRST '!'
+#define KEY_MASK_OTHER ('~' - KEY_MASK_FIRST + 1)
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t source_size;
+    int64_t source_mtime_sec;
+    int64_t source_mtime_nsec;
+    uint32_t count;
+    uint32_t pad;
+} word_index_header;
+
+// Where a word is in the mapped words file
+typedef struct {
+    uint32_t offset;
+    uint32_t len;
+} word_ref;
+
+// Keys a word uses
+typedef struct {
+    uint64_t bits[2];
+} key_mask;
+
+typedef struct {
+    const char *data; // mapped words file, words are not null-terminated
+    size_t size;
+    const word_ref *refs;
+    const key_mask *masks;
+    const uint16_t *lengths; // chars, not bytes
+    size_t count;
+    arena mem;              // refs, masks and lengths built in memory
+    void *index_map;        // mapped index file, NULL if built in memory
+    size_t index_map_size;
+    int shares_data;        // data belongs to the corpus this was filtered from
+} word_corpus;
+
+// Words a test is built from: every word must use a key of include and no
+// key outside only, and have min_len to max_len chars
+typedef struct {
+    key_mask include;
+    key_mask only;
+    uint16_t min_len;
+    uint16_t max_len;
+} word_filter;
+
+// Map a file with one word per line and index its words, leaving out lines
+// that are not valid UTF-8
+// Returns number of words, -1 on failure
+int read_words(const char *filename, word_corpus *corpus);
+
+void free_words(word_corpus *corpus);
+
+// Returns the start of word i and stores its length in len
+const char *corpus_word(const word_corpus *corpus, size_t i, int *len);
+
+// Mask of the keys in s
+void key_mask_of(const char *s, size_t n, key_mask *m);
+
+// Build a filter, include and only may be NULL to allow every key and
+// max_len 0 for no limit
+void word_filter_init(word_filter *f, const char *include, const char *only,
+                      int min_len, int max_len);
+
+// Whether the filter lets every word through
+int word_filter_is_open(const word_filter *f);
+
+// Select the matching words of src into dest, which shares the mapped words
+// file of src and must be freed before it
+// Returns number of words, -1 on failure
+int corpus_filter(const word_corpus *src, const word_filter *f,
+                  word_corpus *dest);
@@ -0,0 +1,189 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "passage.h"
+#include "utf8.h"
+
+// Whitespace and control chars separate words
+static int is_blank(int c) { return c <= ' ' || c == 127; }
+
+// Read more of the file into the free part of the ring
+static void fill(passage *p) {
+    while (!p->eof && p->len < PASSAGE_RING_SIZE) {
+        size_t tail = (p->head + p->len) % PASSAGE_RING_SIZE;
+        size_t room =
+            tail >= p->head ? PASSAGE_RING_SIZE - tail : p->head - tail;
+        ssize_t n = read(p->fd, p->ring + tail, room);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            perror("read");
+        if (n <= 0) {
+            p->eof = 1;
+            break;
+        }
+        p->len += n;
+    }
+}
+
+// Returns the byte i positions ahead, -1 past the end of the file
+static int peek(passage *p, size_t i) {
+    if (i >= p->len)
+        fill(p);
+    if (i >= p->len)
+        return -1;
+    return (unsigned char)p->ring[(p->head + i) % PASSAGE_RING_SIZE];
+}
+
+static void consume(passage *p, size_t n) {
+    p->head = (p->head + n) % PASSAGE_RING_SIZE;
+    p->len -= n;
+}
+
+// Decode the char i bytes ahead, *cp is UTF8_INVALID for bytes that are not
+// UTF-8, which are left out
+// Returns its length in bytes
+static int peek_char(passage *p, size_t i, uint32_t *cp) {
+    char buf[UTF8_MAX_BYTES];
+    int n = 0;
+    int c;
+    while (n < UTF8_MAX_BYTES && (c = peek(p, i + n)) >= 0)
+        buf[n++] = c;
+    return utf8_decode(buf, n, cp);
+}
+
+static void skip_blanks(passage *p) {
+    int c;
+    while ((c = peek(p, 0)) >= 0 && is_blank(c))
+        consume(p, 1);
+}
+
+// Wrap the next line onto the end of the window the same way word tests are
+// wrapped, splitting words that are wider than the terminal
+// Returns its length in bytes, 0 at the end of the file
+static int wrap_line(passage *p) {
+    char *out = p->text + p->text_len;
+    int max = p->width - 1;            // leave a column for the trailing space
+    int room = PASSAGE_LINE_BYTES - 2; // and bytes for " \n"
+    int len = 0;
+    int cols = 0;
+
+    for (;;) {
+        skip_blanks(p);
+
+        // Measure the next word, at most one line of it
+        size_t scan = 0;
+        int word_len = 0;
+        int word_width = 0;
+        int c;
+        while ((c = peek(p, scan)) >= 0 && !is_blank(c)) {
+            uint32_t cp;
+            int n = peek_char(p, scan, &cp);
+            if (cp != UTF8_INVALID) {
+                int w = utf8_width(cp);
+                if (word_len > 0 &&
+                    (word_width + w > max || word_len + n > room))
+                    break;
+                word_len += n;
+                word_width += w;
+            }
+            scan += n;
+        }
+        if (scan == 0)
+            break; // end of file
+        if (word_len == 0) {
+            consume(p, scan);
+            continue;
+        }
+        if (len > 0 &&
+            (cols + 1 + word_width > max || len + 1 + word_len > room))
+            break; // the word starts the next line
+
+        if (len > 0) {
+            out[len++] = ' ';
+            cols++;
+        }
+        for (size_t i = 0; i < scan;) {
+            uint32_t cp;
+            int n = peek_char(p, i, &cp);
+            for (int j = 0; cp != UTF8_INVALID && j < n; j++)
+                out[len++] = peek(p, i + j);
+            i += n;
+        }
+        cols += word_width;
+        consume(p, scan);
+    }
+
+    if (len > 0 && passage_has_more(p)) {
+        out[len++] = ' ';
+        out[len++] = '\n';
+    }
+    p->text_len += len;
+    p->text[p->text_len] = '\0';
+    return len;
+}
+
+static void fill_window(passage *p) {
+    while (p->num_lines < PASSAGE_LINES) {
+        int len = wrap_line(p);
+        if (len == 0)
+            break;
+        p->line_len[p->num_lines++] = len;
+    }
+}
+
+int passage_open(passage *p, const char *filename, int term_width) {
+    memset(p, 0, sizeof(*p));
+    p->fd = open(filename, O_RDONLY);
+    if (p->fd < 0) {
+        perror("Could not open file");
+        return -1;
+    }
+
+    passage_set_width(p, term_width);
+
+    fill_window(p);
+    if (p->num_lines == 0) {
+        fprintf(stderr, "%s: no text to type\n", filename);
+        passage_close(p);
+        return -1;
+    }
+    return 0;
+}
+
+void passage_close(passage *p) {
+    if (p->fd >= 0)
+        close(p->fd);
+    p->fd = -1;
+}
+
+void passage_set_width(passage *p, int term_width) {
+    p->width = term_width;
+    if (p->width > PASSAGE_MAX_WIDTH)
+        p->width = PASSAGE_MAX_WIDTH;
+    if (p->width < 2)
+        p->width = 2;
+}
+
+int passage_has_more(passage *p) {
+    skip_blanks(p);
+    return peek(p, 0) >= 0;
+}
+
+int passage_scroll(passage *p) {
+    if (p->num_lines == 0)
+        return 0;
+
+    int dropped = p->line_len[0];
+    p->text_len -= dropped;
+    memmove(p->text, p->text + dropped, p->text_len + 1);
+    memmove(p->line_len, p->line_len + 1,
+            sizeof(int) * (p->num_lines - 1));
+    p->num_lines--;
+
+    fill_window(p);
+    return dropped;
+}
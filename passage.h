@@ -0,0 +1,41 @@
+#pragma once
+#include <stddef.h>
+
+#define PASSAGE_RING_SIZE 4096 // bytes of the file buffered at once
+#define PASSAGE_LINES 3        // wrapped lines on screen at once
+#define PASSAGE_MAX_WIDTH 512
+#define PASSAGE_LINE_BYTES (4 * PASSAGE_MAX_WIDTH + 2) // UTF-8 and " \n"
+
+// Streams a text file through a fixed ring buffer and wraps it into lines
+// only as they are needed, keeping a window of the next PASSAGE_LINES lines.
+// Runs of whitespace are typed as a single space and bytes that are not
+// UTF-8 are left out.
+typedef struct {
+    int fd;
+    char ring[PASSAGE_RING_SIZE];
+    size_t head; // first unread byte in ring
+    size_t len;  // number of unread bytes in ring
+    int eof;
+    int width; // terminal width
+
+    // Window of wrapped lines, each ending in " \n" unless it is the last
+    char text[PASSAGE_LINES * PASSAGE_LINE_BYTES + 1];
+    int text_len;
+    int line_len[PASSAGE_LINES]; // bytes
+    int num_lines;
+} passage;
+
+// Returns 0 on success, -1 on failure
+int passage_open(passage *p, const char *filename, int term_width);
+
+void passage_close(passage *p);
+
+// Whether there is another line after the window
+int passage_has_more(passage *p);
+
+// Wrap the lines that are not in the window yet at a new terminal width
+void passage_set_width(passage *p, int term_width);
+
+// Drop the first line of the window and wrap one more line onto its end
+// Returns the number of bytes dropped from the front of the text
+int passage_scroll(passage *p);
@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "query.h"
+
+static int matches(char key, char wanted) {
+    return wanted == QUERY_ALL_KEYS || key == wanted;
+}
+
+// Count the matching rows so the columns are allocated once
+static long count_samples(const history_map *m, char key) {
+    size_t offset = 0;
+    history_block b;
+    long n = 0;
+    int r;
+    while ((r = history_next_block(m, &offset, &b)) == 1) {
+        if (key == QUERY_ALL_KEYS) {
+            n += b.num_rows;
+            continue;
+        }
+        for (uint32_t i = 0; i < b.num_rows; i++)
+            n += b.key[i] == key;
+    }
+    return r < 0 ? -1 : n;
+}
+
+long query_key_samples(const char *history_filename, char key,
+                       query_samples *q) {
+    memset(q, 0, sizeof(*q));
+
+    history_map m;
+    if (history_open(history_filename, &m) != 0)
+        return -1;
+    if (!m.data)
+        return 0;
+
+    long n = count_samples(&m, key);
+    if (n < 0) {
+        fprintf(stderr, "%s: corrupt block\n", history_filename);
+        history_close(&m);
+        return -1;
+    }
+
+    // All columns share one allocation, the 8 byte ones first
+    unsigned char *p = malloc((sizeof(int64_t) + sizeof(double) + 3) * n + 1);
+    if (!p) {
+        perror("malloc failed");
+        history_close(&m);
+        return -1;
+    }
+    q->num_rows = n;
+    q->date = (int64_t *)p;
+    q->wpm = (double *)(p + sizeof(int64_t) * n);
+    q->key = (char *)(q->wpm + n);
+    q->prev_key = q->key + n;
+    q->acc = (uint8_t *)q->prev_key + n;
+
+    size_t offset = 0;
+    history_block b;
+    long row = 0;
+    while (history_next_block(&m, &offset, &b) == 1) {
+        for (uint32_t i = 0; i < b.num_rows; i++) {
+            if (!matches(b.key[i], key))
+                continue;
+            q->date[row] = b.date;
+            q->wpm[row] = b.wpm[i];
+            q->key[row] = b.key[i];
+            q->prev_key[row] = b.prev_key[i];
+            q->acc[row] = b.acc[i];
+            row++;
+        }
+    }
+
+    history_close(&m);
+    return n;
+}
+
+void query_samples_free(query_samples *q) {
+    free(q->date);
+    memset(q, 0, sizeof(*q));
+}
+
+long query_games(const char *history_filename, query_game **games) {
+    *games = NULL;
+
+    history_map m;
+    if (history_open(history_filename, &m) != 0)
+        return -1;
+    if (!m.data)
+        return 0;
+
+    long n = 0;
+    long cap = 0;
+    size_t offset = 0;
+    history_block b;
+    int r;
+    while ((r = history_next_block(&m, &offset, &b)) == 1) {
+        if (n == cap) {
+            cap = cap ? cap * 2 : 256;
+            query_game *g = realloc(*games, sizeof(query_game) * cap);
+            if (!g) {
+                perror("realloc failed");
+                r = -1;
+                break;
+            }
+            *games = g;
+        }
+
+        query_game *g = &(*games)[n++];
+        g->date = b.date;
+        g->num_rows = b.num_rows;
+        g->correct = 0;
+        g->wpm_sum = 0.0;
+        for (uint32_t i = 0; i < b.num_rows; i++) {
+            g->correct += b.acc[i] ? 1 : 0;
+            g->wpm_sum += b.wpm[i];
+        }
+    }
+
+    history_close(&m);
+    if (r < 0) {
+        fprintf(stderr, "%s: could not read games\n", history_filename);
+        free(*games);
+        *games = NULL;
+        return -1;
+    }
+    return n;
+}
+
+int query_digraphs(const char *aggregate_filename,
+                   const char *history_filename, agg_cell per_key[AGG_KEYS],
+                   agg_cell digraph[AGG_KEYS][AGG_KEYS]) {
+    // Too big for the stack of a Python thread
+    aggregate *a = malloc(sizeof(*a));
+    if (!a) {
+        perror("malloc failed");
+        return -1;
+    }
+
+    uint64_t num_rows;
+    int loaded = aggregate_filename &&
+                 aggregate_load(aggregate_filename, a, &num_rows);
+    if (!loaded && aggregate_rebuild(history_filename, a) < 0) {
+        free(a);
+        return -1;
+    }
+
+    memcpy(per_key, a->per_key, sizeof(a->per_key));
+    memcpy(digraph, a->digraph, sizeof(a->digraph));
+    free(a);
+    return 0;
+}
+
+void query_free(void *p) { free(p); }
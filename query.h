@@ -0,0 +1,49 @@
+#pragma once
+#include <stdint.h>
+
+#include "aggregate.h"
+
+// Queries over a key history file, built into libneotapstats.so for the
+// plotting scripts. Results are contiguous arrays that neotapstats.py wraps
+// as numpy arrays without copying.
+
+#define QUERY_ALL_KEYS '\0'
+
+// Matching keystrokes in playing order, one array per column
+typedef struct {
+    uint64_t num_rows;
+    int64_t *date;
+    double *wpm;
+    char *key;
+    char *prev_key;
+    uint8_t *acc;
+} query_samples;
+
+// Totals of one game block
+typedef struct {
+    int64_t date;
+    uint32_t num_rows;
+    uint32_t correct;
+    double wpm_sum;
+} query_game;
+
+// Collect every keystroke of key, or of all keys with QUERY_ALL_KEYS
+// Free the columns with query_samples_free
+// Returns number of rows, -1 on failure
+long query_key_samples(const char *history_filename, char key,
+                       query_samples *q);
+
+void query_samples_free(query_samples *q);
+
+// One row per game, oldest first. Free *games with query_free
+// Returns number of games, -1 on failure
+long query_games(const char *history_filename, query_game **games);
+
+// Fill the per-key and [prevKey][key] tables of every printable key, from the
+// aggregate snapshot if there is one and from the whole history otherwise
+// Returns 0 on success, -1 on failure
+int query_digraphs(const char *aggregate_filename,
+                   const char *history_filename, agg_cell per_key[AGG_KEYS],
+                   agg_cell digraph[AGG_KEYS][AGG_KEYS]);
+
+void query_free(void *p);
@@ -0,0 +1,241 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "render.h"
+#include "utf8.h"
+
+#define SGR_DEFAULT 0
+#define SGR_RED 31
+#define SGR_GREEN 32
+#define ATTR_REVERSE 0x100 // added to a colour for the ghost's cursor
+
+// Work out where every char of the text is on screen
+static int layout(renderer *r, const char *text) {
+    r->text = text;
+    r->len = strlen(text);
+    if (r->len + 1 > r->cap) {
+        int cap = r->len + 1;
+        int *row = realloc(r->row, sizeof(int) * cap);
+        if (row)
+            r->row = row;
+        int *col = realloc(r->col, sizeof(int) * cap);
+        if (col)
+            r->col = col;
+        unsigned char *shown = realloc(r->shown, cap);
+        if (shown)
+            r->shown = shown;
+        if (!row || !col || !shown) {
+            perror("realloc failed");
+            return -1;
+        }
+        r->cap = cap;
+    }
+    memset(r->shown, CELL_UNTYPED, r->len + 1);
+
+    // The bytes of a multi-byte char share its cell, as wide as the char
+    int row = 0;
+    int col = 0;
+    for (int i = 0; i < r->len;) {
+        uint32_t cp;
+        int n = utf8_decode(text + i, r->len - i, &cp);
+        for (int j = i; j < i + n; j++) {
+            r->row[j] = row;
+            r->col[j] = col;
+        }
+        if (text[i] == '\n') {
+            row++;
+            col = 0;
+        } else {
+            col += cp == UTF8_INVALID ? 1 : utf8_width(cp);
+        }
+        i += n;
+    }
+    // One past the end is where the cursor rests when the text is done
+    r->row[r->len] = row;
+    r->col[r->len] = col;
+    return 0;
+}
+
+int render_init(renderer *r, const char *text) {
+    memset(r, 0, sizeof(*r));
+    r->out_cap = 256;
+    r->out = malloc(r->out_cap);
+    if (!r->out) {
+        perror("malloc failed");
+        return -1;
+    }
+    if (layout(r, text) != 0) {
+        render_free(r);
+        return -1;
+    }
+
+    r->cur_row = r->row[r->len];
+    r->cur_col = r->col[r->len];
+    r->attr = SGR_DEFAULT;
+    r->ghost_idx = -1;
+    return 0;
+}
+
+void render_free(renderer *r) {
+    free(r->row);
+    free(r->col);
+    free(r->shown);
+    free(r->out);
+    r->row = NULL;
+    r->col = NULL;
+    r->shown = NULL;
+    r->out = NULL;
+}
+
+static void append(renderer *r, const char *s, size_t n) {
+    if (r->out_len + n > r->out_cap) {
+        size_t cap = r->out_cap * 2;
+        while (r->out_len + n > cap)
+            cap *= 2;
+        char *out = realloc(r->out, cap);
+        if (!out)
+            return; // drop the rest of the frame rather than crash
+        r->out = out;
+        r->out_cap = cap;
+    }
+    memcpy(r->out + r->out_len, s, n);
+    r->out_len += n;
+}
+
+static void move_to(renderer *r, int row, int col) {
+    char seq[32];
+    int n = 0;
+    if (row < r->cur_row)
+        n += snprintf(seq + n, sizeof(seq) - n, "\033[%dA", r->cur_row - row);
+    else if (row > r->cur_row)
+        n += snprintf(seq + n, sizeof(seq) - n, "\033[%dB", row - r->cur_row);
+    if (col != r->cur_col)
+        n += snprintf(seq + n, sizeof(seq) - n, "\033[%dG", col + 1);
+    append(r, seq, n);
+    r->cur_row = row;
+    r->cur_col = col;
+}
+
+static void set_attr(renderer *r, int attr) {
+    if (attr == r->attr)
+        return;
+    char seq[16];
+    int n;
+    if (attr & ATTR_REVERSE)
+        n = snprintf(seq, sizeof(seq), "\033[%d;7m", attr & ~ATTR_REVERSE);
+    else if (r->attr & ATTR_REVERSE)
+        n = snprintf(seq, sizeof(seq), "\033[27;%dm", attr);
+    else
+        n = snprintf(seq, sizeof(seq), "\033[%dm", attr);
+    append(r, seq, n);
+    r->attr = attr;
+}
+
+static void flush(renderer *r) {
+    size_t off = 0;
+    while (off < r->out_len) {
+        ssize_t n = write(STDOUT_FILENO, r->out + off, r->out_len - off);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        off += n;
+    }
+    r->out_len = 0;
+}
+
+int render_set_text(renderer *r, const char *text) {
+    int old_rows = r->row[r->len] + 1;
+    if (layout(r, text) != 0)
+        return -1;
+    int rows = r->row[r->len] + 1;
+    if (rows < old_rows)
+        rows = old_rows; // clear lines the text no longer reaches
+
+    set_attr(r, SGR_DEFAULT);
+    const char *line = text;
+    for (int row = 0; row < rows; row++) {
+        move_to(r, row, 0);
+        append(r, "\033[2K", 4);
+        const char *end = strchr(line, '\n');
+        int n = end ? end - line : (int)strlen(line);
+        append(r, line, n);
+        line += n;
+        r->cur_col = r->col[line - text];
+        line += end ? 1 : 0;
+    }
+    return 0;
+}
+
+void render_ghost(renderer *r, int idx) { r->ghost_idx = idx; }
+
+void render_hud(renderer *r, const char *line) {
+    set_attr(r, SGR_DEFAULT);
+    move_to(r, -1, 0);
+    append(r, "\033[2K", 4);
+    append(r, line, strlen(line));
+    r->cur_col = utf8_text_width(line, strlen(line));
+}
+
+int render_reset(renderer *r, const char *text) {
+    set_attr(r, SGR_DEFAULT);
+    append(r, "\033[H\033[2J", 7);
+    r->cur_row = -1;
+    r->cur_col = 0;
+    return render_set_text(r, text);
+}
+
+void render_frame(renderer *r, const int *correct_chars, int current_idx) {
+    for (int i = 0; i < r->len; i++) {
+        char c = r->text[i];
+        if (c == '\n' || utf8_is_cont(c))
+            continue;
+
+        int state = CELL_UNTYPED;
+        if (i < current_idx)
+            state = correct_chars[i] ? CELL_CORRECT : CELL_WRONG;
+        if (i == r->ghost_idx)
+            state |= CELL_GHOST;
+        if (state == r->shown[i])
+            continue;
+
+        move_to(r, r->row[i], r->col[i]);
+        int ghost = state & CELL_GHOST ? ATTR_REVERSE : 0;
+        if ((state & ~CELL_GHOST) == CELL_WRONG) {
+            // Red for failed char, underscore if it was a space
+            set_attr(r, SGR_RED | ghost);
+            if (c == ' ')
+                c = '_';
+        } else if ((state & ~CELL_GHOST) == CELL_CORRECT) {
+            set_attr(r, SGR_GREEN | ghost);
+        } else {
+            set_attr(r, SGR_DEFAULT | ghost);
+        }
+        uint32_t cp;
+        int n = utf8_decode(r->text + i, r->len - i, &cp);
+        if (cp == UTF8_INVALID) {
+            append(r, "?", 1);
+        } else if (n == 1) {
+            append(r, &c, 1);
+        } else {
+            append(r, r->text + i, n);
+        }
+        r->cur_col = r->col[i + n];
+        r->shown[i] = state;
+    }
+    set_attr(r, SGR_DEFAULT);
+
+    // Park the cursor on the next char to type, skipping line breaks
+    int next = current_idx;
+    while (next < r->len && r->text[next] == '\n')
+        next++;
+    if (next > r->len)
+        next = r->len;
+    move_to(r, r->row[next], r->col[next]);
+
+    flush(r);
+}
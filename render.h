@@ -0,0 +1,56 @@
+#pragma once
+#include <stddef.h>
+
+typedef enum {
+    CELL_UNTYPED,
+    CELL_CORRECT,
+    CELL_WRONG,
+    CELL_GHOST = 4, // flag, the ghost's cursor is on the cell
+} cell_state;
+
+// Keeps a copy of what the test text currently looks like on screen so that
+// each frame only redraws the cells that changed
+typedef struct {
+    const char *text;
+    int len;
+    int cap;              // text indexes the arrays below have room for
+    int *row;             // screen row of each text index, relative to line 1
+    int *col;             // screen column of each text index
+    unsigned char *shown; // cell_state currently on screen
+    int cur_row;          // where the terminal cursor is
+    int cur_col;
+    int attr; // SGR colour currently active, 0 for default
+    int ghost_idx; // text index of the ghost's cursor, -1 without a ghost
+    char *out;
+    size_t out_len;
+    size_t out_cap;
+} renderer;
+
+// Start tracking text that has just been printed uncoloured, leaving the
+// cursor after its last character
+// Returns 0 on success, -1 on failure
+int render_init(renderer *r, const char *text);
+
+// Bring the screen in line with the typed state and put the cursor at
+// current_idx, using a single write()
+void render_frame(renderer *r, const int *correct_chars, int current_idx);
+
+// Replace the text on screen, e.g. when a passage scrolls, by redrawing it
+// uncoloured from its first line; the redraw goes out with the next frame
+// Returns 0 on success, -1 on failure
+int render_set_text(renderer *r, const char *text);
+
+// Put the ghost's cursor on a text index, -1 to hide it; it moves with the
+// next frame, which redraws only the cell it leaves and the one it lands on
+void render_ghost(renderer *r, int idx);
+
+// Show a status line on the row above the text, it goes out with the next
+// frame
+void render_hud(renderer *r, const char *line);
+
+// Clear the screen and draw the text uncoloured from its top, after a resize
+// left the old screen unusable; the HUD row is left empty
+// Returns 0 on success, -1 on failure
+int render_reset(renderer *r, const char *text);
+
+void render_free(renderer *r);
@@ -0,0 +1,442 @@
+#include <errno.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rollup.h"
+
+int64_t rollup_period(int tier, int64_t date) {
+    if (tier == ROLLUP_GAME)
+        return date;
+
+    time_t t = date;
+    struct tm tm;
+    localtime_r(&t, &tm);
+    tm.tm_hour = 0;
+    tm.tm_min = 0;
+    tm.tm_sec = 0;
+    tm.tm_isdst = -1;
+    if (tier == ROLLUP_WEEK)
+        tm.tm_mday -= (tm.tm_wday + 6) % 7; // back to Monday
+    return mktime(&tm);
+}
+
+static void init_rows(rollup_row *rows) {
+    memset(rows, 0, sizeof(rollup_row) * NUM_KEYS);
+    for (int i = 0; i < NUM_KEYS; i++)
+        rows[i].key = FIRST_KEY + i;
+}
+
+static void add_keystroke(rollup_row *row, double wpm, int correct) {
+    if (row->count == 0 || wpm < row->wpm_min)
+        row->wpm_min = wpm;
+    if (row->count == 0 || wpm > row->wpm_max)
+        row->wpm_max = wpm;
+    row->count++;
+    row->correct += correct ? 1 : 0;
+    row->wpm_sum += wpm;
+}
+
+static void merge_row(rollup_row *dest, const rollup_row *src) {
+    if (src->count == 0)
+        return;
+    if (dest->count == 0 || src->wpm_min < dest->wpm_min)
+        dest->wpm_min = src->wpm_min;
+    if (dest->count == 0 || src->wpm_max > dest->wpm_max)
+        dest->wpm_max = src->wpm_max;
+    dest->count += src->count;
+    dest->correct += src->correct;
+    dest->wpm_sum += src->wpm_sum;
+}
+
+void rollup_rows_from_stats(const stats *s, rollup_row *rows) {
+    init_rows(rows);
+    for (int i = 0; i < NUM_KEYS; i++) {
+        const key_stats *k = &s->per_key[i];
+        for (const key_press_block *b = k->history; b; b = b->next) {
+            for (int j = 0; j < b->len; j++)
+                add_keystroke(&rows[i], b->presses[j].wpm,
+                              b->presses[j].correct);
+        }
+    }
+}
+
+static void rows_from_block(const history_block *b, rollup_row *rows) {
+    init_rows(rows);
+    for (uint32_t i = 0; i < b->num_rows; i++) {
+        int k = key_index((unsigned char)b->key[i]);
+        if (k >= 0)
+            add_keystroke(&rows[k], b->wpm[i], b->acc[i]);
+    }
+}
+
+// Game blocks leave out keys that were not typed
+static uint32_t block_rows(int tier, const rollup_row *rows,
+                           rollup_row *out) {
+    uint32_t n = 0;
+    for (int i = 0; i < NUM_KEYS; i++) {
+        if (tier == ROLLUP_GAME && rows[i].count == 0)
+            continue;
+        out[n++] = rows[i];
+    }
+    return n;
+}
+
+static void init_file_header(rollup_file_header *h, int tier) {
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, ROLLUP_MAGIC, sizeof(h->magic));
+    h->version = ROLLUP_VERSION;
+    h->tier = tier;
+}
+
+static int write_block(FILE *f, int tier, int64_t period,
+                       const rollup_row *rows) {
+    rollup_row out[NUM_KEYS];
+    rollup_block_header h;
+    h.magic = ROLLUP_BLOCK_MAGIC;
+    h.num_rows = block_rows(tier, rows, out);
+    h.period = period;
+    if (h.num_rows == 0)
+        return 0;
+    return fwrite(&h, sizeof(h), 1, f) == 1 &&
+                   fwrite(out, sizeof(rollup_row), h.num_rows, f) ==
+                       h.num_rows
+               ? 0
+               : -1;
+}
+
+static ssize_t pread_full(int fd, void *buf, size_t size, off_t offset) {
+    ssize_t n;
+    do {
+        n = pread(fd, buf, size, offset);
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
+
+// Header of version 1 files, which had no compaction watermark
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t tier;
+    uint32_t pad;
+} rollup_file_header_v1;
+
+// Rewrite a file of an older version with the current header. Day and week
+// blocks written before NUM_KEYS grew to every printable key have fewer rows,
+// they are widened to a row per key and a period split over two blocks by
+// the change is merged again.
+static int upgrade(const char *filename, uint32_t version, int tier) {
+    FILE *in = fopen(filename, "rb");
+    if (!in) {
+        perror("Could not open rollup");
+        return -1;
+    }
+    unsigned char *data = NULL;
+    long size = -1;
+    if (fseek(in, 0, SEEK_END) == 0)
+        size = ftell(in);
+    if (size > 0 && fseek(in, 0, SEEK_SET) == 0)
+        data = malloc(size);
+    int ok = data && fread(data, size, 1, in) == 1;
+    fclose(in);
+    if (!ok) {
+        perror("Could not read rollup");
+        free(data);
+        return -1;
+    }
+
+    char tmp_filename[512];
+    snprintf(tmp_filename, sizeof(tmp_filename), "%s.tmp", filename);
+    FILE *out = fopen(tmp_filename, "wb");
+    if (!out) {
+        perror("fopen");
+        free(data);
+        return -1;
+    }
+
+    rollup_file_header h;
+    init_file_header(&h, tier);
+    size_t offset = sizeof(rollup_file_header_v1);
+    if (version >= 2) {
+        memcpy(&h.compacted_before,
+               data + offsetof(rollup_file_header, compacted_before),
+               sizeof(h.compacted_before));
+        offset = sizeof(rollup_file_header);
+    }
+    ok = fwrite(&h, sizeof(h), 1, out) == 1;
+
+    int64_t period = 0;
+    rollup_row pending[NUM_KEYS];
+    int have_pending = 0;
+    while (ok && offset < (size_t)size) {
+        rollup_block_header b;
+        if ((size_t)size - offset < sizeof(b)) {
+            ok = 0;
+            break;
+        }
+        memcpy(&b, data + offset, sizeof(b));
+        size_t rows_size = sizeof(rollup_row) * b.num_rows;
+        if (b.magic != ROLLUP_BLOCK_MAGIC ||
+            (size_t)size - offset - sizeof(b) < rows_size) {
+            ok = 0;
+            break;
+        }
+        const unsigned char *rows = data + offset + sizeof(b);
+        offset += sizeof(b) + rows_size;
+
+        if (tier == ROLLUP_GAME) {
+            ok = fwrite(data + offset - sizeof(b) - rows_size,
+                        sizeof(b) + rows_size, 1, out) == 1;
+            continue;
+        }
+        if (have_pending && b.period != period) {
+            ok = write_block(out, tier, period, pending) == 0;
+            have_pending = 0;
+        }
+        if (!have_pending) {
+            init_rows(pending);
+            period = b.period;
+            have_pending = 1;
+        }
+        for (uint32_t i = 0; i < b.num_rows; i++) {
+            rollup_row row;
+            memcpy(&row, rows + sizeof(row) * i, sizeof(row));
+            int k = key_index((unsigned char)row.key);
+            if (k >= 0)
+                merge_row(&pending[k], &row);
+        }
+    }
+    if (ok && have_pending)
+        ok = write_block(out, tier, period, pending) == 0;
+    free(data);
+
+    if (fclose(out) != 0)
+        ok = 0;
+    if (!ok || rename(tmp_filename, filename) != 0) {
+        fprintf(stderr, "%s: could not upgrade rollup file\n", filename);
+        remove(tmp_filename);
+        return -1;
+    }
+    return 0;
+}
+
+// Open a tier file for update, creating it if needed and upgrading it if it
+// is from an older version
+// Returns the descriptor with h read and *end set, -1 on failure
+static int open_tier(const char *filename, int tier, rollup_file_header *h,
+                     off_t *end) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        int fd = open(filename, O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+            perror("Could not open rollup");
+            return -1;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            perror("fstat");
+            close(fd);
+            return -1;
+        }
+        *end = st.st_size;
+        if (*end == 0) {
+            init_file_header(h, tier);
+            *end = sizeof(*h);
+            if (pwrite(fd, h, sizeof(*h), 0) == sizeof(*h))
+                return fd;
+            perror("Could not write rollup");
+            close(fd);
+            return -1;
+        }
+
+        rollup_file_header_v1 old;
+        int ok = pread_full(fd, &old, sizeof(old), 0) == sizeof(old) &&
+                 memcmp(old.magic, ROLLUP_MAGIC, sizeof(old.magic)) == 0 &&
+                 old.tier == (uint32_t)tier;
+        if (ok && old.version >= 1 && old.version < ROLLUP_VERSION &&
+            attempt == 0) {
+            close(fd);
+            if (upgrade(filename, old.version, tier) != 0)
+                return -1;
+            continue;
+        }
+        if (ok && old.version == ROLLUP_VERSION &&
+            pread_full(fd, h, sizeof(*h), 0) == sizeof(*h))
+            return fd;
+        fprintf(stderr, "%s: not a version %d rollup file\n", filename,
+                ROLLUP_VERSION);
+        close(fd);
+        return -1;
+    }
+    return -1;
+}
+
+int rollup_compacted_before(const char *filename, int tier,
+                            int64_t *before) {
+    rollup_file_header h;
+    off_t end;
+    int fd = open_tier(filename, tier, &h, &end);
+    if (fd < 0)
+        return -1;
+    close(fd);
+    *before = h.compacted_before;
+    return 0;
+}
+
+int rollup_set_compacted(const char *filename, int tier, int64_t before) {
+    rollup_file_header h;
+    off_t end;
+    int fd = open_tier(filename, tier, &h, &end);
+    if (fd < 0)
+        return -1;
+    int ok = 1;
+    if (before > h.compacted_before) {
+        h.compacted_before = before;
+        ok = pwrite(fd, &h, sizeof(h), 0) == sizeof(h);
+    }
+    if (close(fd) != 0)
+        ok = 0;
+    if (!ok) {
+        perror("Could not write rollup");
+        return -1;
+    }
+    return 0;
+}
+
+int rollup_add(const char *filename, int tier, int64_t date,
+               const rollup_row *rows) {
+    rollup_file_header h;
+    off_t end;
+    int fd = open_tier(filename, tier, &h, &end);
+    if (fd < 0)
+        return -1;
+    int ok = 1;
+
+    int64_t period = rollup_period(tier, date);
+
+    // Fold the game into the current day or week if it is the last block
+    size_t full_block =
+        sizeof(rollup_block_header) + sizeof(rollup_row) * NUM_KEYS;
+    if (tier != ROLLUP_GAME && (size_t)end >= sizeof(h) + full_block) {
+        off_t offset = end - full_block;
+        rollup_block_header b;
+        rollup_row last[NUM_KEYS];
+        if (pread_full(fd, &b, sizeof(b), offset) == sizeof(b) &&
+            b.magic == ROLLUP_BLOCK_MAGIC && b.num_rows == NUM_KEYS &&
+            b.period == period &&
+            pread_full(fd, last, sizeof(last), offset + sizeof(b)) ==
+                sizeof(last)) {
+            for (int i = 0; i < NUM_KEYS; i++)
+                merge_row(&last[i], &rows[i]);
+            ok = pwrite(fd, last, sizeof(last), offset + sizeof(b)) ==
+                 sizeof(last);
+            if (close(fd) != 0)
+                ok = 0;
+            return ok ? 0 : -1;
+        }
+    }
+
+    rollup_row out[NUM_KEYS];
+    rollup_block_header b;
+    b.magic = ROLLUP_BLOCK_MAGIC;
+    b.num_rows = block_rows(tier, rows, out);
+    b.period = period;
+    if (b.num_rows > 0) {
+        size_t size = sizeof(rollup_row) * b.num_rows;
+        ok = pwrite(fd, &b, sizeof(b), end) == sizeof(b) &&
+             pwrite(fd, out, size, end + sizeof(b)) == (ssize_t)size;
+    }
+    if (close(fd) != 0)
+        ok = 0;
+    if (!ok) {
+        perror("Could not write rollup");
+        return -1;
+    }
+    return 0;
+}
+
+int rollup_rebuild(const char *history_filename,
+                   const char *const filenames[ROLLUP_NUM_TIERS]) {
+    history_reader reader;
+    if (history_reader_open(history_filename, &reader) != 0)
+        return -1;
+
+    char tmp_filenames[ROLLUP_NUM_TIERS][512];
+    FILE *files[ROLLUP_NUM_TIERS] = {NULL};
+    int ok = 1;
+    for (int t = 0; t < ROLLUP_NUM_TIERS; t++) {
+        if (!filenames[t])
+            continue;
+        snprintf(tmp_filenames[t], sizeof(tmp_filenames[t]), "%s.tmp",
+                 filenames[t]);
+        files[t] = fopen(tmp_filenames[t], "wb");
+        rollup_file_header h;
+        init_file_header(&h, t);
+        if (!files[t] || fwrite(&h, sizeof(h), 1, files[t]) != 1)
+            ok = 0;
+    }
+
+    // Days and weeks are written once the history moves past them
+    int64_t period[ROLLUP_NUM_TIERS];
+    rollup_row pending[ROLLUP_NUM_TIERS][NUM_KEYS];
+    int have_pending[ROLLUP_NUM_TIERS] = {0};
+
+    history_block b;
+    int r = 0;
+    while (ok && (r = history_reader_next(&reader, &b)) == 1) {
+        rollup_row rows[NUM_KEYS];
+        rows_from_block(&b, rows);
+        if (files[ROLLUP_GAME] &&
+            write_block(files[ROLLUP_GAME], ROLLUP_GAME, b.date, rows) != 0)
+            ok = 0;
+
+        for (int t = ROLLUP_DAY; t < ROLLUP_NUM_TIERS; t++) {
+            if (!files[t])
+                continue;
+            int64_t p = rollup_period(t, b.date);
+            if (have_pending[t] && p != period[t]) {
+                if (write_block(files[t], t, period[t], pending[t]) != 0)
+                    ok = 0;
+                have_pending[t] = 0;
+            }
+            if (!have_pending[t]) {
+                init_rows(pending[t]);
+                period[t] = p;
+                have_pending[t] = 1;
+            }
+            for (int i = 0; i < NUM_KEYS; i++)
+                merge_row(&pending[t][i], &rows[i]);
+        }
+    }
+    history_reader_close(&reader);
+    for (int t = ROLLUP_DAY; ok && t < ROLLUP_NUM_TIERS; t++) {
+        if (have_pending[t] &&
+            write_block(files[t], t, period[t], pending[t]) != 0)
+            ok = 0;
+    }
+    if (r < 0) {
+        fprintf(stderr, "%s: corrupt key history\n", history_filename);
+        ok = 0;
+    }
+
+    for (int t = 0; t < ROLLUP_NUM_TIERS; t++) {
+        if (files[t] && fclose(files[t]) != 0)
+            ok = 0;
+    }
+    for (int t = 0; t < ROLLUP_NUM_TIERS; t++) {
+        if (!filenames[t])
+            continue;
+        if (!ok || rename(tmp_filenames[t], filenames[t]) != 0) {
+            ok = 0;
+            remove(tmp_filenames[t]);
+        }
+    }
+    if (!ok)
+        perror("Could not build rollups");
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include <stdint.h>
+
+#include "history.h"
+#include "stats.h"
+
+// Rollup tier files, stats/<player>.rollup-{game,day,week}.bin (native byte
+// order):
+//
+//   file header   "NTRU" + uint32 version, uint32 tier, uint32 pad,
+//                 int64 compacted_before
+//   period block  uint32 magic, uint32 num_rows, int64 period start
+//                 rollup_row rows[num_rows]
+//
+// Game blocks hold the keys typed in the game. Day and week blocks, in local
+// time with weeks starting on Monday, always hold a row for every key, so
+// the block of the current period is the last NUM_KEYS rows of the file and
+// is updated in place.
+//
+// Once the key history has been compacted, keystrokes played before
+// compacted_before are only kept in the tiers, which then can't be rebuilt
+// from the history any more.
+
+#define ROLLUP_MAGIC "NTRU"
+#define ROLLUP_VERSION 3
+#define ROLLUP_BLOCK_MAGIC 0x4b42524e // "NRBK"
+
+enum { ROLLUP_GAME, ROLLUP_DAY, ROLLUP_WEEK, ROLLUP_NUM_TIERS };
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t tier;
+    uint32_t pad;
+    int64_t compacted_before; // 0 if the history was never compacted
+} rollup_file_header;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t num_rows;
+    int64_t period;
+} rollup_block_header;
+
+// Keystrokes of one key in one period
+typedef struct {
+    char key;
+    char pad[3];
+    uint32_t count;
+    uint32_t correct;
+    uint32_t pad2;
+    double wpm_sum;
+    double wpm_min;
+    double wpm_max;
+} rollup_row;
+
+// Start of the period of a tier that date falls in
+int64_t rollup_period(int tier, int64_t date);
+
+// Fill rows[NUM_KEYS] with the keystrokes of a game
+void rollup_rows_from_stats(const stats *s, rollup_row *rows);
+
+// Add a game played at date to a tier file
+// Returns 0 on success, -1 on failure
+int rollup_add(const char *filename, int tier, int64_t date,
+               const rollup_row *rows);
+
+// Write the tier files from scratch from a key history, tiers with a NULL
+// filename are left alone
+// Returns 0 on success, -1 on failure
+int rollup_rebuild(const char *history_filename,
+                   const char *const filenames[ROLLUP_NUM_TIERS]);
+
+// Read compacted_before of a tier file
+// Returns 0 on success, -1 on failure
+int rollup_compacted_before(const char *filename, int tier,
+                            int64_t *before);
+
+// Record that the key history no longer holds keystrokes before the date,
+// a later date already recorded is kept
+// Returns 0 on success, -1 on failure
+int rollup_set_compacted(const char *filename, int tier, int64_t before);
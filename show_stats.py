@@ -1,30 +1,35 @@
+import numpy as np
 import pandas as pd
 import matplotlib.pyplot as plt
 import seaborn as sns
 import argparse
 
+import neotapstats
+
 # --- Parse command-line arguments ---
 parser = argparse.ArgumentParser(description="Show various stats.")
 parser.add_argument("-p", "--player", type=str, required=True, help="Player to show stats for")
 args = parser.parse_args()
 player = args.player
 
-# --- Load CSV ---
-df = pd.read_csv(f"stats/{player}.key-history.csv")
-
-# Convert date column to datetime and sort
-df['date'] = pd.to_datetime(df['date'])
-df = df.sort_values('date').reset_index(drop=True)
+# --- Load key history ---
+# Per-key and digraph tables come from the library, only the WPM distribution
+# and the trigrams need every keystroke
+per_key_cells, digraph_cells = neotapstats.digraphs(player)
+df = neotapstats.key_samples_frame(player)
 
 # Filter out rows without a previous key
-df = df[df['prevKey'].notna()]
+df = df[df['prevKey'].notna()].reset_index(drop=True)
 
 # --- Per Key Stats ---
-per_key = df.groupby("key").agg(
-    presses=("key", "count"),
-    avg_wpm=("wpm", "mean"),
-    accuracy=("acc", "mean")
-).reset_index()
+keys = np.array(neotapstats.AGG_KEY_CHARS)
+per_key = pd.DataFrame({
+    "key": keys,
+    "presses": per_key_cells["count"].astype(np.int64),
+    "avg_wpm": per_key_cells["wpm_sum"] / np.maximum(per_key_cells["count"], 1),
+    "accuracy": per_key_cells["correct"] / np.maximum(per_key_cells["count"], 1),
+})
+per_key = per_key[per_key["presses"] > 0].reset_index(drop=True)
 
 # --- Accuracy per Key ---
 plt.figure(figsize=(12, 5))
@@ -52,7 +57,16 @@ plt.xlabel("Key")
 plt.show()
 
 # --- Key Transition Heatmap ---
-transitions = df.groupby(["prevKey", "key"]).size().unstack(fill_value=0)
+cells = digraph_cells.ravel()
+digraph_speed = pd.DataFrame({
+    "prevKey": np.repeat(keys, neotapstats.AGG_KEYS),
+    "key": np.tile(keys, neotapstats.AGG_KEYS),
+    "count": cells["count"].astype(np.int64),
+    "avg_wpm": cells["wpm_sum"] / np.maximum(cells["count"], 1),
+    "accuracy": cells["correct"] / np.maximum(cells["count"], 1),
+})
+digraph_speed = digraph_speed[digraph_speed["count"] > 0].reset_index(drop=True)
+transitions = digraph_speed.pivot(index="prevKey", columns="key", values="count").fillna(0)
 plt.figure(figsize=(14, 10))
 sns.heatmap(transitions, cmap="Blues", cbar=True)
 plt.title("Key Transition Heatmap (prevKey → key)")
@@ -69,13 +83,6 @@ plt.ylabel("Frequency")
 plt.show()
 
 # --- Digraphs: Key-to-Key Transitions ---
-digraphs = df.copy()
-digraph_speed = digraphs.groupby(["prevKey", "key"]).agg(
-    avg_wpm=("wpm", "mean"),
-    count=("wpm", "size"),
-    accuracy=("acc", "mean")
-).reset_index()
-
 # Top fastest transitions
 fastest = digraph_speed.sort_values("avg_wpm", ascending=False).head(15)
 print("\n🔥 Fastest key-to-key transitions:")
@@ -0,0 +1,267 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "snapshot.h"
+
+static uint32_t checksum(const void *data, size_t size) {
+    const unsigned char *p = data;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Versions 1 and 2 counted a-z only, their matrices also had a row and
+// column for space and one for anything else
+#define V2_KEYS 26
+#define V2_SPACE 26
+#define V2_OTHER 27
+
+typedef struct {
+    int64_t games_played;
+    int64_t total_keystrokes;
+    int64_t correct_keystrokes;
+    double time_spent;
+    double best_wpm;
+    snapshot_key per_key[V2_KEYS];
+    snapshot_key digraph[V2_KEYS + 1][V2_KEYS];
+    int64_t confusion[V2_KEYS + 2][V2_KEYS + 2];
+} snapshot_body_v2;
+
+// Version 1 ended after the per-key counters
+#define SNAPSHOT_V1_BODY_SIZE offsetof(snapshot_body_v2, digraph)
+
+void snapshot_encode(snapshot_file *snap, const stats *s) {
+    memset(snap, 0, sizeof(*snap));
+
+    snapshot_body *b = &snap->body;
+    b->games_played = s->total.games_played;
+    b->total_keystrokes = s->total.total_keystrokes;
+    b->correct_keystrokes = s->total.correct_keystrokes;
+    b->time_spent = s->total.time_spent;
+    b->best_wpm = s->total.best_wpm;
+    for (int i = 0; i < NUM_KEYS; i++) {
+        b->per_key[i].pressed = s->per_key[i].pressed;
+        b->per_key[i].correct = s->per_key[i].correct;
+        b->per_key[i].time_spent = s->per_key[i].time_spent;
+        memcpy(b->latency[i], s->per_key[i].latency.count,
+               sizeof(b->latency[i]));
+    }
+    for (int p = 0; p < NUM_KEYS; p++) {
+        for (int k = 0; k < NUM_KEYS; k++) {
+            b->digraph[p][k].pressed = s->digraph[p][k].pressed;
+            b->digraph[p][k].correct = s->digraph[p][k].correct;
+            b->digraph[p][k].time_spent = s->digraph[p][k].time_spent;
+        }
+    }
+    for (int e = 0; e < NUM_TYPED_KEYS; e++) {
+        for (int t = 0; t < NUM_TYPED_KEYS; t++)
+            b->confusion[e][t] = s->confusion[e][t];
+    }
+    for (int i = 0; i < NUM_WIDE_KEYS; i++) {
+        b->wide_keys[i].codepoint = s->wide_keys[i].codepoint;
+        b->wide_keys[i].pressed = s->wide_keys[i].pressed;
+        b->wide_keys[i].correct = s->wide_keys[i].correct;
+        b->wide_keys[i].time_spent = s->wide_keys[i].time_spent;
+    }
+
+    snapshot_header *h = &snap->header;
+    memcpy(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic));
+    h->version = SNAPSHOT_VERSION;
+    h->num_keys = NUM_KEYS;
+    h->checksum = checksum(b, sizeof(*b));
+}
+
+static size_t body_size(uint32_t version) {
+    if (version == 1)
+        return SNAPSHOT_V1_BODY_SIZE;
+    if (version == 2)
+        return sizeof(snapshot_body_v2);
+    if (version == 3)
+        return SNAPSHOT_V3_BODY_SIZE;
+    if (version == SNAPSHOT_VERSION)
+        return sizeof(snapshot_body);
+    return 0;
+}
+
+static uint32_t num_keys(uint32_t version) {
+    return version < 3 ? V2_KEYS : NUM_KEYS;
+}
+
+// Where a key of a version 2 matrix went
+static int v2_key_index(int index) {
+    if (index == V2_SPACE)
+        return key_index(' ');
+    if (index == V2_OTHER)
+        return TYPED_KEY_OTHER;
+    return key_index('a' + index);
+}
+
+static void decode_v2(const snapshot_body_v2 *b, uint32_t version,
+                      stats *s) {
+    for (int i = 0; i < V2_KEYS; i++) {
+        key_stats *k = &s->per_key[key_index('a' + i)];
+        k->pressed = b->per_key[i].pressed;
+        k->correct = b->per_key[i].correct;
+        k->time_spent = b->per_key[i].time_spent;
+    }
+    if (version == 1)
+        return;
+
+    for (int p = 0; p < V2_KEYS + 1; p++) {
+        for (int k = 0; k < V2_KEYS; k++) {
+            digraph_stats *d = &s->digraph[v2_key_index(p)][v2_key_index(k)];
+            d->pressed = b->digraph[p][k].pressed;
+            d->correct = b->digraph[p][k].correct;
+            d->time_spent = b->digraph[p][k].time_spent;
+        }
+    }
+    for (int e = 0; e < V2_KEYS + 2; e++) {
+        for (int t = 0; t < V2_KEYS + 2; t++)
+            s->confusion[v2_key_index(e)][v2_key_index(t)] =
+                b->confusion[e][t];
+    }
+}
+
+static int decode(const snapshot_file *snap, size_t body_bytes, stats *s) {
+    const snapshot_header *h = &snap->header;
+    if (memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic)) != 0 ||
+        body_size(h->version) == 0 || h->num_keys != num_keys(h->version) ||
+        body_size(h->version) != body_bytes ||
+        h->checksum != checksum(&snap->body, body_bytes))
+        return -1;
+
+    // The totals start every version
+    const snapshot_body *b = &snap->body;
+    s->total.games_played = b->games_played;
+    s->total.total_keystrokes = b->total_keystrokes;
+    s->total.correct_keystrokes = b->correct_keystrokes;
+    s->total.time_spent = b->time_spent;
+    s->total.best_wpm = b->best_wpm;
+    for (int i = 0; i < NUM_KEYS; i++) {
+        key_stats *k = &s->per_key[i];
+        k->key = FIRST_KEY + i;
+        k->pressed = 0;
+        k->correct = 0;
+        k->time_spent = 0.0;
+        memset(&k->latency, 0, sizeof(k->latency));
+    }
+    memset(s->digraph, 0, sizeof(s->digraph));
+    memset(s->confusion, 0, sizeof(s->confusion));
+    memset(s->wide_keys, 0, sizeof(s->wide_keys));
+
+    if (h->version < 3) {
+        decode_v2((const snapshot_body_v2 *)b, h->version, s);
+        return 0;
+    }
+
+    for (int i = 0; i < NUM_KEYS; i++) {
+        s->per_key[i].pressed = b->per_key[i].pressed;
+        s->per_key[i].correct = b->per_key[i].correct;
+        s->per_key[i].time_spent = b->per_key[i].time_spent;
+        if (h->version > 3)
+            memcpy(s->per_key[i].latency.count, b->latency[i],
+                   sizeof(b->latency[i]));
+    }
+    for (int p = 0; p < NUM_KEYS; p++) {
+        for (int k = 0; k < NUM_KEYS; k++) {
+            s->digraph[p][k].pressed = b->digraph[p][k].pressed;
+            s->digraph[p][k].correct = b->digraph[p][k].correct;
+            s->digraph[p][k].time_spent = b->digraph[p][k].time_spent;
+        }
+    }
+    for (int e = 0; e < NUM_TYPED_KEYS; e++) {
+        for (int t = 0; t < NUM_TYPED_KEYS; t++)
+            s->confusion[e][t] = b->confusion[e][t];
+    }
+    // Slots are kept as they are, the table hashes the same way
+    for (int i = 0; i < NUM_WIDE_KEYS; i++) {
+        s->wide_keys[i].codepoint = b->wide_keys[i].codepoint;
+        s->wide_keys[i].pressed = b->wide_keys[i].pressed;
+        s->wide_keys[i].correct = b->wide_keys[i].correct;
+        s->wide_keys[i].time_spent = b->wide_keys[i].time_spent;
+    }
+    return 0;
+}
+
+int snapshot_decode(const snapshot_file *snap, stats *s) {
+    return decode(snap, sizeof(snap->body), s);
+}
+
+int snapshot_load(const char *filename, stats *s) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return errno == ENOENT ? 0 : -1;
+
+    // Read one byte more than a snapshot to catch trailing garbage, older
+    // versions are shorter
+    snapshot_file snap;
+    char extra;
+    ssize_t n;
+    do {
+        n = read(fd, &snap, sizeof(snap));
+    } while (n < 0 && errno == EINTR);
+    int trailing = n == sizeof(snap) && read(fd, &extra, 1) > 0;
+    close(fd);
+
+    size_t header_size = sizeof(snap.header);
+    if (n < (ssize_t)header_size || trailing ||
+        decode(&snap, n - header_size, s) != 0) {
+        fprintf(stderr, "%s: invalid stats snapshot\n", filename);
+        return -1;
+    }
+    return 1;
+}
+
+int snapshot_write_tmp(const char *filename, const stats *s) {
+    snapshot_file snap;
+    snapshot_encode(&snap, s);
+
+    char tmp_filename[512];
+    snprintf(tmp_filename, sizeof(tmp_filename), "%s.tmp", filename);
+
+    int fd = open(tmp_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("open");
+        return -1;
+    }
+    ssize_t n;
+    do {
+        n = write(fd, &snap, sizeof(snap));
+    } while (n < 0 && errno == EINTR);
+    if (n != sizeof(snap)) {
+        perror("Could not write stats snapshot");
+        close(fd);
+        remove(tmp_filename);
+        return -1;
+    }
+    return fd;
+}
+
+int snapshot_commit(const char *filename, int fd) {
+    char tmp_filename[512];
+    snprintf(tmp_filename, sizeof(tmp_filename), "%s.tmp", filename);
+
+    // Make sure the data is on disk before the rename makes it visible
+    int ok = fsync(fd) == 0;
+    if (close(fd) != 0)
+        ok = 0;
+    if (!ok || rename(tmp_filename, filename) != 0) {
+        perror("Could not save stats snapshot");
+        remove(tmp_filename);
+        return -1;
+    }
+    return 0;
+}
+
+int snapshot_save(const char *filename, const stats *s) {
+    int fd = snapshot_write_tmp(filename, s);
+    if (fd < 0)
+        return -1;
+    return snapshot_commit(filename, fd);
+}
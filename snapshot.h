@@ -0,0 +1,90 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include "stats.h"
+
+// Binary player snapshot, stats/<player>.overall.bin (native byte order):
+//
+//   header        "NTPS" + uint32 version, uint32 num_keys and a FNV-1a
+//                 checksum of the body
+//   body          the total counters, the counters of every printable ASCII
+//                 key, the digraph matrix, the confusion matrix, the table
+//                 of keys past ASCII and the latency histogram of every
+//                 key, fixed size so the whole file is one read
+//
+// It is always replaced by renaming a complete temp file over it. Versions 1
+// and 2 only counted a-z, see snapshot.c, version 3 ended before the latency
+// histograms.
+
+#define SNAPSHOT_MAGIC "NTPS"
+#define SNAPSHOT_VERSION 4
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t num_keys;
+    uint32_t checksum;
+} snapshot_header;
+
+typedef struct {
+    int64_t pressed;
+    int64_t correct;
+    double time_spent;
+} snapshot_key;
+
+// Matrix cells are many, 32 bit counters keep the file small
+typedef struct {
+    uint32_t pressed;
+    uint32_t correct;
+    double time_spent;
+} snapshot_cell;
+
+typedef struct {
+    uint32_t codepoint;
+    uint32_t pressed;
+    uint32_t correct;
+    uint32_t pad;
+    double time_spent;
+} snapshot_wide_key;
+
+typedef struct {
+    int64_t games_played;
+    int64_t total_keystrokes;
+    int64_t correct_keystrokes;
+    double time_spent;
+    double best_wpm;
+    snapshot_key per_key[NUM_KEYS];
+    snapshot_cell digraph[NUM_KEYS][NUM_KEYS];
+    uint32_t confusion[NUM_TYPED_KEYS][NUM_TYPED_KEYS];
+    snapshot_wide_key wide_keys[NUM_WIDE_KEYS];
+    uint32_t latency[NUM_KEYS][LATENCY_BUCKETS];
+} snapshot_body;
+
+// Size of the version 3 body, the start of the current one
+#define SNAPSHOT_V3_BODY_SIZE offsetof(snapshot_body, latency)
+
+typedef struct {
+    snapshot_header header;
+    snapshot_body body;
+} snapshot_file;
+
+void snapshot_encode(snapshot_file *snap, const stats *s);
+
+// Fill the counters of s from a snapshot, the history arrays are untouched
+// Returns 0 on success, -1 if the snapshot is invalid
+int snapshot_decode(const snapshot_file *snap, stats *s);
+
+// Returns 1 if loaded, 0 if there is no snapshot, -1 if it is invalid
+int snapshot_load(const char *filename, stats *s);
+
+// Saving is split in two so that many snapshots can be written before any of
+// them is synced: write <filename>.tmp and return its open fd, or -1
+int snapshot_write_tmp(const char *filename, const stats *s);
+
+// Sync and close the fd from snapshot_write_tmp() and rename it into place
+// Returns 0 on success, -1 on failure
+int snapshot_commit(const char *filename, int fd);
+
+// Returns 0 on success, -1 on failure
+int snapshot_save(const char *filename, const stats *s);
@@ -1,12 +1,34 @@
+#include <dirent.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/file.h>
 #include <sys/stat.h>
 #include <time.h>
-
+#include <unistd.h>
+
+#include "aggregate.h"
+#include "arena.h"
+#include "events.h"
+#include "history.h"
+#include "leaderboard.h"
+#include "rollup.h"
+#include "snapshot.h"
 #include "stats.h"
+#include "timing.h"
+#include "utf8.h"
 
 #define STATS_FILE_BASE_NAME "stats/"
+#define LEADERBOARD_FILE STATS_FILE_BASE_NAME "leaderboard.bin"
+#define LEADERBOARD_LOCK STATS_FILE_BASE_NAME "leaderboard.lock"
+#define LEADERBOARD_TOP 10
+#define SECONDS_PER_DAY 86400
+#define MISTYPES_SHOWN 5
+#define TEXT_STATS_KEYS 26 // a-z in the old overall.txt
+
+static const char *rollup_tier_names[ROLLUP_NUM_TIERS] = {"game", "day",
+                                                          "week"};
 
 void init_stats(stats *s) {
     s->total.games_played = 0;
@@ -16,61 +38,130 @@ void init_stats(stats *s) {
     s->total.best_wpm = 0.0;
 
     for (int i = 0; i < NUM_KEYS; i++) {
-        s->per_key[i].key = 'a' + i;
+        s->per_key[i].key = FIRST_KEY + i;
         s->per_key[i].pressed = 0;
         s->per_key[i].correct = 0;
         s->per_key[i].time_spent = 0.0;
-        s->per_key[i].history_len = 16; // Should grow dynamically if needed
-
-        // Allocate initial history arrays
-        s->per_key[i].wpm_history =
-            malloc(sizeof(double) * s->per_key[i].history_len);
-        s->per_key[i].acc_history =
-            malloc(sizeof(int) * s->per_key[i].history_len);
-        s->per_key[i].prev_key_history =
-            malloc(sizeof(char) * s->per_key[i].history_len);
-
-        // zero-initialize
-        if (s->per_key[i].wpm_history)
-            memset(s->per_key[i].wpm_history, 0,
-                   sizeof(double) * s->per_key[i].history_len);
-        if (s->per_key[i].acc_history)
-            memset(s->per_key[i].acc_history, 0,
-                   sizeof(int) * s->per_key[i].history_len);
-        if (s->per_key[i].prev_key_history)
-            memset(s->per_key[i].prev_key_history, '\0',
-                   sizeof(int) * s->per_key[i].history_len);
-    }
-}
-
-// Append to dynamic array, grow if needed
-static void append_history(key_stats *k, double wpm, int correct,
+        memset(&s->per_key[i].latency, 0, sizeof(s->per_key[i].latency));
+        s->per_key[i].history = NULL;
+        s->per_key[i].history_tail = NULL;
+        s->per_key[i].history_len = 0;
+    }
+
+    memset(s->digraph, 0, sizeof(s->digraph));
+    memset(s->confusion, 0, sizeof(s->confusion));
+    memset(s->wide_keys, 0, sizeof(s->wide_keys));
+    s->arena = NULL;
+}
+
+void free_stats(stats *s) {
+    for (int i = 0; i < NUM_KEYS; i++) {
+        s->per_key[i].history = NULL;
+        s->per_key[i].history_tail = NULL;
+        s->per_key[i].history_len = 0;
+    }
+}
+
+// Append to the last block, chaining a new one from the arena when it is full
+static void append_history(stats *s, key_stats *k, double wpm, int correct,
                            char prev_key) {
-    if (k->pressed >= k->history_len) {
-        // Grow by 2x
-        k->history_len *= 2;
-        k->wpm_history =
-            realloc(k->wpm_history, sizeof(double) * k->history_len);
-        k->acc_history = realloc(k->acc_history, sizeof(int) * k->history_len);
+    key_press_block *b = k->history_tail;
+    if (!b || b->len == KEY_PRESS_BLOCK) {
+        if (!s->arena)
+            return;
+        key_press_block *next = arena_alloc(s->arena, sizeof(*next));
+        if (!next)
+            return;
+        if (b)
+            b->next = next;
+        else
+            k->history = next;
+        k->history_tail = next;
+        b = next;
     }
-    k->wpm_history[k->pressed] = wpm;
-    k->acc_history[k->pressed] = correct;
-    k->prev_key_history[k->pressed] = prev_key;
+    k->history_len++;
+    key_press *press = &b->presses[b->len++];
+    press->wpm = wpm;
+    press->prev_key = prev_key;
+    press->correct = correct ? 1 : 0;
 }
 
-void update_key_stats(stats *s, char key_char, int correct, double time_taken,
-                      char prev_key) {
-    if (key_char < 'a' || key_char > 'z')
-        return;
+int key_index(uint32_t key) {
+    if (key < FIRST_KEY || key >= FIRST_KEY + NUM_KEYS)
+        return -1;
+    return key - FIRST_KEY;
+}
+
+int typed_key_index(uint32_t key) {
+    int index = key_index(key);
+    return index >= 0 ? index : TYPED_KEY_OTHER;
+}
 
-    int index = key_char - 'a';
+static uint32_t wide_key_slot(uint32_t codepoint) {
+    return (codepoint * 2654435761u) >> 26; // top 6 bits, NUM_WIDE_KEYS slots
+}
 
+// Probe the table from the slot the codepoint hashes to
+// Returns its slot, a free one if insert is set and it is missing, or NULL
+static wide_key_stats *lookup_wide_key(wide_key_stats *table,
+                                       uint32_t codepoint, int insert) {
+    uint32_t slot = wide_key_slot(codepoint);
+    for (int i = 0; i < WIDE_KEY_MAX_PROBES; i++) {
+        wide_key_stats *w = &table[(slot + i) % NUM_WIDE_KEYS];
+        if (w->codepoint == codepoint)
+            return w;
+        if (w->codepoint == 0) {
+            if (!insert)
+                return NULL;
+            w->codepoint = codepoint;
+            return w;
+        }
+    }
+    return NULL; // too crowded, the key goes uncounted
+}
+
+const wide_key_stats *find_wide_key(const stats *s, uint32_t codepoint) {
+    return lookup_wide_key((wide_key_stats *)s->wide_keys, codepoint, 0);
+}
+
+void update_key_stats(stats *s, uint32_t key, int correct, int64_t time_ns,
+                      uint32_t prev_key) {
+    double time_taken = ns_to_sec(time_ns);
+
+    int index = key_index(key);
+    if (index < 0) {
+        if (key < 0x80 || key == UTF8_INVALID)
+            return; // control chars
+        wide_key_stats *w = lookup_wide_key(s->wide_keys, key, 1);
+        if (w) {
+            w->pressed++;
+            w->correct += correct;
+            w->time_spent += time_taken;
+        }
+        return;
+    }
+
+    // The key history only has room for ASCII previous keys
     double wpm = calc_wpm(1, time_taken);
-    append_history(&s->per_key[index], wpm, correct, prev_key);
+    append_history(s, &s->per_key[index], wpm, correct,
+                   prev_key < 0x80 ? (char)prev_key : '\0');
 
     s->per_key[index].pressed++;
     s->per_key[index].correct += correct;
     s->per_key[index].time_spent += time_taken;
+    latency_add(&s->per_key[index].latency, time_ns);
+
+    int prev = key_index(prev_key);
+    if (prev >= 0) {
+        digraph_stats *d = &s->digraph[prev][index];
+        d->pressed++;
+        d->correct += correct;
+        d->time_spent += time_taken;
+    }
+}
+
+void update_confusion(stats *s, uint32_t expected, uint32_t typed) {
+    s->confusion[typed_key_index(expected)][typed_key_index(typed)]++;
 }
 
 void update_total_stats(stats *stats, int total_keystrokes,
@@ -105,6 +196,33 @@ void merge_stats(stats *dest, const stats *src) {
         dest->per_key[i].pressed += src->per_key[i].pressed;
         dest->per_key[i].correct += src->per_key[i].correct;
         dest->per_key[i].time_spent += src->per_key[i].time_spent;
+        latency_merge(&dest->per_key[i].latency, &src->per_key[i].latency);
+    }
+
+    for (int i = 0; i < NUM_WIDE_KEYS; i++) {
+        const wide_key_stats *src_w = &src->wide_keys[i];
+        if (src_w->codepoint == 0)
+            continue;
+        wide_key_stats *w =
+            lookup_wide_key(dest->wide_keys, src_w->codepoint, 1);
+        if (!w)
+            continue;
+        w->pressed += src_w->pressed;
+        w->correct += src_w->correct;
+        w->time_spent += src_w->time_spent;
+    }
+
+    // Merge the matrices
+    for (int p = 0; p < NUM_KEYS; p++) {
+        for (int k = 0; k < NUM_KEYS; k++) {
+            dest->digraph[p][k].pressed += src->digraph[p][k].pressed;
+            dest->digraph[p][k].correct += src->digraph[p][k].correct;
+            dest->digraph[p][k].time_spent += src->digraph[p][k].time_spent;
+        }
+    }
+    for (int e = 0; e < NUM_TYPED_KEYS; e++) {
+        for (int t = 0; t < NUM_TYPED_KEYS; t++)
+            dest->confusion[e][t] += src->confusion[e][t];
     }
 }
 
@@ -126,37 +244,111 @@ static FILE *open_csv_with_header(const char *filename, const char *header) {
     return f;
 }
 
-void save_game_history(const char *player_name, stats *s) {
-    // Get current timestamp
-    time_t now = time(NULL);
-    struct tm *t = localtime(&now);
+// Build the missing rollup tiers from the key history, unless it has been
+// compacted and no longer holds all the keystrokes of the other tiers
+// Returns a mask of the rebuilt tiers, -1 on failure
+static int ensure_rollups(const char *player_name,
+                          char filenames[ROLLUP_NUM_TIERS][256]) {
+    const char *missing[ROLLUP_NUM_TIERS] = {NULL};
+    int rebuilt = 0;
+    int64_t compacted_before = 0;
+    for (int t = 0; t < ROLLUP_NUM_TIERS; t++) {
+        snprintf(filenames[t], 256, "%s%s.rollup-%s.bin",
+                 STATS_FILE_BASE_NAME, player_name, rollup_tier_names[t]);
+        if (!file_exists(filenames[t])) {
+            missing[t] = filenames[t];
+            rebuilt |= 1 << t;
+            continue;
+        }
+        int64_t before;
+        if (rollup_compacted_before(filenames[t], t, &before) != 0)
+            return -1;
+        if (before > compacted_before)
+            compacted_before = before;
+    }
+    if (!rebuilt)
+        return 0;
+
+    char keys_binfile[256];
+    snprintf(keys_binfile, sizeof(keys_binfile), "%s%s.key-history.bin",
+             STATS_FILE_BASE_NAME, player_name);
+    if (!file_exists(keys_binfile))
+        return 0; // nothing to roll up yet
+    if (compacted_before > 0) {
+        fprintf(stderr,
+                "The key history of %s has been compacted, so the missing "
+                "rollups can't be rebuilt from it\n",
+                player_name);
+        return -1;
+    }
+    return rollup_rebuild(keys_binfile, missing) == 0 ? rebuilt : -1;
+}
+
+// Add a game that was just appended to the key history to every tier
+static void save_rollups(const char *player_name, int64_t date,
+                         const stats *s) {
+    char filenames[ROLLUP_NUM_TIERS][256];
+    int rebuilt = ensure_rollups(player_name, filenames);
+
+    // Rebuilt tiers already hold this game, tiers that could not be rebuilt
+    // are not started over with only the games from now on
+    rollup_row rows[NUM_KEYS];
+    rollup_rows_from_stats(s, rows);
+    for (int t = 0; t < ROLLUP_NUM_TIERS; t++) {
+        if (rebuilt >= 0 ? !(rebuilt & 1 << t) : file_exists(filenames[t]))
+            rollup_add(filenames[t], t, date, rows);
+    }
+}
+
+long compact_key_history(const char *player_name, int keep_days) {
+    // Dropped keystrokes must be in the rollups first
+    char filenames[ROLLUP_NUM_TIERS][256];
+    if (ensure_rollups(player_name, filenames) < 0)
+        return -1;
+
+    char keys_binfile[256];
+    snprintf(keys_binfile, sizeof(keys_binfile), "%s%s.key-history.bin",
+             STATS_FILE_BASE_NAME, player_name);
+    if (!file_exists(keys_binfile))
+        return 0;
+    int64_t cutoff = time(NULL) - (int64_t)keep_days * SECONDS_PER_DAY;
+    long dropped = history_compact(keys_binfile, cutoff);
+    if (dropped <= 0)
+        return dropped;
+
+    // From now on the tiers are the only record of the dropped keystrokes
+    for (int t = 0; t < ROLLUP_NUM_TIERS; t++) {
+        if (rollup_set_compacted(filenames[t], t, cutoff) != 0)
+            return -1;
+    }
+    return dropped;
+}
+
+void save_game_history(const char *player_name, int64_t date, stats *s) {
+    time_t played = date;
+    struct tm *t = localtime(&played);
     char datetimebuf[20]; // "YYYY-MM-DD HH:MM:SS"
     strftime(datetimebuf, sizeof(datetimebuf), "%Y-%m-%d %H:%M:%S", t);
 
     // Save key-level history
-    char keys_csvfile[256];
-    snprintf(keys_csvfile, sizeof(keys_csvfile), "%s%s.key-history.csv",
+    char keys_binfile[256];
+    snprintf(keys_binfile, sizeof(keys_binfile), "%s%s.key-history.bin",
              STATS_FILE_BASE_NAME, player_name);
-    FILE *keys_csv =
-        open_csv_with_header(keys_csvfile, "date,key,prevKey,wpm,acc");
-    if (keys_csv) {
-        for (int i = 0; i < NUM_KEYS; i++) {
-            for (int j = 0; j < s->per_key[i].pressed; j++) {
-                if (s->per_key[i].prev_key_history[j] == '\0') {
-                    fprintf(keys_csv, "%s,%c,%s,%.6f,%d\n", datetimebuf,
-                            s->per_key[i].key, "", s->per_key[i].wpm_history[j],
-                            s->per_key[i].acc_history[j]);
-                } else {
-                    fprintf(keys_csv, "%s,%c,%c,%.6f,%d\n", datetimebuf,
-                            s->per_key[i].key,
-                            s->per_key[i].prev_key_history[j],
-                            s->per_key[i].wpm_history[j],
-                            s->per_key[i].acc_history[j]);
-                }
-            }
-        }
-        fclose(keys_csv);
+    if (!file_exists(keys_binfile)) {
+        // Carry over history recorded in the old CSV format
+        char keys_csvfile[256];
+        snprintf(keys_csvfile, sizeof(keys_csvfile), "%s%s.key-history.csv",
+                 STATS_FILE_BASE_NAME, player_name);
+        // Imported once, a rebuilt history must not bring it back
+        char imported[512];
+        snprintf(imported, sizeof(imported), "%s.imported", keys_csvfile);
+        if (file_exists(keys_csvfile) &&
+            history_import_csv(keys_csvfile, keys_binfile) >= 0 &&
+            rename(keys_csvfile, imported) != 0)
+            perror("Could not rename the imported CSV history");
     }
+    if (history_append_game(keys_binfile, date, s) == 0)
+        save_rollups(player_name, date, s);
 
     // Save game-level summary
     char game_csvfile[256];
@@ -172,34 +364,207 @@ void save_game_history(const char *player_name, stats *s) {
     }
 }
 
-void save_stats(const char *player_name, stats *s) {
+int load_aggregate(const char *player_name, aggregate *a) {
     char filename[256];
-    snprintf(filename, sizeof(filename), "%s%s.overall.txt",
+    snprintf(filename, sizeof(filename), "%s%s.aggregate.bin",
              STATS_FILE_BASE_NAME, player_name);
 
-    FILE *f = fopen(filename, "w");
-    if (!f) {
+    uint64_t num_rows;
+    return aggregate_load(filename, a, &num_rows);
+}
+
+void save_aggregate(const char *player_name, stats *s) {
+    char filename[256];
+    snprintf(filename, sizeof(filename), "%s%s.aggregate.bin",
+             STATS_FILE_BASE_NAME, player_name);
+
+    static aggregate agg;
+    uint64_t num_rows;
+    if (aggregate_load(filename, &agg, &num_rows)) {
+        // Only this game's keystrokes need to be added
+        aggregate_add_stats(&agg, s);
+        for (int i = 0; i < NUM_KEYS; i++)
+            num_rows += s->per_key[i].history_len;
+    } else {
+        // No snapshot yet, build it from the history saved so far
+        char keys_binfile[256];
+        snprintf(keys_binfile, sizeof(keys_binfile), "%s%s.key-history.bin",
+                 STATS_FILE_BASE_NAME, player_name);
+        long rows = aggregate_rebuild(keys_binfile, &agg);
+        if (rows < 0)
+            return;
+        num_rows = rows;
+    }
+
+    aggregate_save(filename, &agg, num_rows);
+}
+
+void save_game_events(const char *player_name, int64_t date, uint32_t seed,
+                      const char *text, const event_log *log) {
+    char filename[256];
+    snprintf(filename, sizeof(filename), "%s%s.events", STATS_FILE_BASE_NAME,
+             player_name);
+    events_append_game(filename, date, seed, text, log);
+}
+
+int export_key_history(const char *player_name) {
+    char keys_binfile[256];
+    snprintf(keys_binfile, sizeof(keys_binfile), "%s%s.key-history.bin",
+             STATS_FILE_BASE_NAME, player_name);
+    // Not the name of the old CSV history, or it would be imported again
+    char keys_csvfile[256];
+    snprintf(keys_csvfile, sizeof(keys_csvfile),
+             "%s%s.key-history.export.csv", STATS_FILE_BASE_NAME, player_name);
+
+    return history_export_csv(keys_binfile, keys_csvfile);
+}
+
+// Add every player in the stats directory, for when there is no index yet
+static void add_all_players(leaderboard *lb) {
+    DIR *dir = opendir(STATS_FILE_BASE_NAME);
+    if (!dir)
         return;
+
+    static const char *suffixes[] = {".overall.bin", ".overall.txt"};
+    struct dirent *d;
+    while ((d = readdir(dir)) != NULL) {
+        size_t len = strlen(d->d_name);
+        for (int i = 0; i < 2; i++) {
+            size_t suffix_len = strlen(suffixes[i]);
+            if (len <= suffix_len ||
+                strcmp(d->d_name + len - suffix_len, suffixes[i]) != 0)
+                continue;
+
+            char player[256];
+            snprintf(player, sizeof(player), "%.*s", (int)(len - suffix_len),
+                     d->d_name);
+            stats s;
+            memset(&s, 0, sizeof(s));
+            if (load_stats(player, &s) == 1)
+                leaderboard_update(lb, player, &s);
+        }
     }
+    closedir(dir);
+}
 
-    // Save total stats
-    fprintf(f, "games_played %d\n", s->total.games_played);
-    fprintf(f, "total_keystrokes %d\n", s->total.total_keystrokes);
-    fprintf(f, "correct_keystrokes %d\n", s->total.correct_keystrokes);
-    fprintf(f, "time_spent %lf\n", s->total.time_spent);
-    fprintf(f, "best_wpm %lf\n", s->total.best_wpm);
+static void update_leaderboard(const char *const *player_names,
+                               stats *const *s, int n) {
+    // Games finishing at the same time must not lose each other's update
+    int lock = open(LEADERBOARD_LOCK, O_RDWR | O_CREAT, 0644);
+    if (lock < 0 || flock(lock, LOCK_EX) != 0) {
+        perror("Could not lock leaderboard");
+        if (lock >= 0)
+            close(lock);
+        return;
+    }
 
-    // Save per-key stats
-    for (int i = 0; i < NUM_KEYS; i++) {
-        const key_stats *k = &s->per_key[i];
-        fprintf(f, "key %c pressed %d correct %d time_spent %lf\n", k->key,
-                k->pressed, k->correct, k->time_spent);
+    // Only the entries that move are written, an index that cannot be used
+    // is rebuilt from the players' stats
+    leaderboard lb;
+    if (leaderboard_open(LEADERBOARD_FILE, 1, &lb) != 1) {
+        if (leaderboard_create(LEADERBOARD_FILE, &lb) != 0) {
+            close(lock);
+            return;
+        }
+        add_all_players(&lb);
     }
+    for (int i = 0; i < n; i++)
+        leaderboard_update(&lb, player_names[i], s[i]);
+    leaderboard_close(&lb);
 
-    fclose(f);
+    close(lock); // releases the lock
 }
 
-int load_stats(const char *player_name, stats *s) {
+int print_leaderboard(const char *player_name) {
+    // Wait out a save in progress, the index is updated in place
+    int lock = open(LEADERBOARD_LOCK, O_RDONLY);
+    if (lock >= 0)
+        flock(lock, LOCK_SH);
+    leaderboard lb;
+    if (leaderboard_open(LEADERBOARD_FILE, 0, &lb) != 1) {
+        fprintf(stderr, "No leaderboard yet, play a game first\n");
+        if (lock >= 0)
+            close(lock);
+        return -1;
+    }
+
+    static const char *titles[LB_NUM_ORDERS] = {"BEST WPM", "AVERAGE WPM",
+                                                "ACCURACY"};
+    for (int o = 0; o < LB_NUM_ORDERS; o++) {
+        printf("==== %s ====\n", titles[o]);
+        for (uint32_t r = 0; r < LEADERBOARD_TOP && r < lb.h->count; r++) {
+            const leaderboard_entry *e = leaderboard_at(&lb, o, r);
+            printf("%2u. %-20s best %6.2fwpm  avg %6.2fwpm  acc %6.2f%%  "
+                   "games %d\n",
+                   r + 1, e->player, e->score[LB_BEST_WPM],
+                   e->score[LB_AVG_WPM], e->score[LB_ACCURACY],
+                   e->games_played);
+        }
+    }
+
+    if (player_name) {
+        const leaderboard_entry *e = leaderboard_find(&lb, player_name);
+        if (e)
+            printf("%s: #%u best wpm, #%u average wpm, #%u accuracy of %u "
+                   "players\n",
+                   player_name, e->rank[LB_BEST_WPM] + 1,
+                   e->rank[LB_AVG_WPM] + 1, e->rank[LB_ACCURACY] + 1,
+                   lb.h->count);
+        else
+            printf("%s is not on the leaderboard yet\n", player_name);
+    }
+
+    leaderboard_close(&lb);
+    if (lock >= 0)
+        close(lock);
+    return 0;
+}
+
+void save_stats(const char *player_name, stats *s) {
+    save_stats_batch(&player_name, &s, 1);
+}
+
+int save_stats_batch(const char *const *player_names, stats *const *s,
+                     int n) {
+    int *fds = malloc(sizeof(int) * (n > 0 ? n : 1));
+    if (!fds) {
+        perror("malloc failed");
+        return -1;
+    }
+
+    // Write every snapshot before syncing any of them
+    int ret = 0;
+    char filename[256];
+    for (int i = 0; i < n; i++) {
+        snprintf(filename, sizeof(filename), "%s%s.overall.bin",
+                 STATS_FILE_BASE_NAME, player_names[i]);
+        fds[i] = snapshot_write_tmp(filename, s[i]);
+        if (fds[i] < 0)
+            ret = -1;
+    }
+    for (int i = 0; i < n; i++) {
+        if (fds[i] < 0)
+            continue;
+        snprintf(filename, sizeof(filename), "%s%s.overall.bin",
+                 STATS_FILE_BASE_NAME, player_names[i]);
+        if (snapshot_commit(filename, fds[i]) != 0)
+            ret = -1;
+    }
+    free(fds);
+
+    // One sync of the directory makes all the renames durable
+    int dir = open(STATS_FILE_BASE_NAME, O_RDONLY);
+    if (dir >= 0) {
+        fsync(dir);
+        close(dir);
+    }
+
+    update_leaderboard(player_names, s, n);
+    return ret;
+}
+
+// Stats saved before the binary snapshot existed
+static int load_stats_text(const char *player_name, stats *s) {
     char filename[256];
     snprintf(filename, sizeof(filename), "%s%s.overall.txt",
              STATS_FILE_BASE_NAME, player_name);
@@ -210,24 +575,114 @@ int load_stats(const char *player_name, stats *s) {
     }
 
     // Load total stats
-    fscanf(f, "games_played %d\n", &s->total.games_played);
-    fscanf(f, "total_keystrokes %d\n", &s->total.total_keystrokes);
-    fscanf(f, "correct_keystrokes %d\n", &s->total.correct_keystrokes);
-    fscanf(f, "time_spent %lf\n", &s->total.time_spent);
-    fscanf(f, "best_wpm %lf\n", &s->total.best_wpm);
-
-    // Load per-key stats
-    for (int i = 0; i < NUM_KEYS; i++) {
-        key_stats *k = &s->per_key[i];
-        fscanf(f, "key %c pressed %d correct %d time_spent %lf\n", &k->key,
-               &k->pressed, &k->correct, &k->time_spent);
+    int fields = 0;
+    fields += fscanf(f, "games_played %d\n", &s->total.games_played);
+    fields += fscanf(f, "total_keystrokes %d\n", &s->total.total_keystrokes);
+    fields +=
+        fscanf(f, "correct_keystrokes %d\n", &s->total.correct_keystrokes);
+    fields += fscanf(f, "time_spent %lf\n", &s->total.time_spent);
+    fields += fscanf(f, "best_wpm %lf\n", &s->total.best_wpm);
+
+    // Load per-key stats, the text format only ever held a-z
+    for (int i = 0; i < TEXT_STATS_KEYS; i++) {
+        key_stats k;
+        int n = fscanf(f, "key %c pressed %d correct %d time_spent %lf\n",
+                       &k.key, &k.pressed, &k.correct, &k.time_spent);
+        fields += n;
+        int index = key_index((unsigned char)k.key);
+        if (n != 4 || index < 0)
+            break;
+        s->per_key[index].pressed = k.pressed;
+        s->per_key[index].correct = k.correct;
+        s->per_key[index].time_spent = k.time_spent;
     }
 
     fclose(f);
 
+    if (fields != 5 + 4 * TEXT_STATS_KEYS) {
+        fprintf(stderr, "%s: ignoring unreadable stats\n", filename);
+        return 0;
+    }
     return 1;
 }
 
+int load_stats(const char *player_name, stats *s) {
+    char filename[256];
+    snprintf(filename, sizeof(filename), "%s%s.overall.bin",
+             STATS_FILE_BASE_NAME, player_name);
+
+    char kept[512];
+    snprintf(kept, sizeof(kept), "%s.corrupt", filename);
+
+    int r = snapshot_load(filename, s);
+    if (r == 1)
+        return 1;
+    // Migrate from the text format, the next save writes the snapshot. The
+    // text stats may be far older than a snapshot that was kept aside.
+    if (r == 0)
+        return access(kept, F_OK) == 0 ? 0 : load_stats_text(player_name, s);
+
+    // Kept aside so the next save does not replace it
+    if (rename(filename, kept) != 0) {
+        perror("Could not keep the invalid stats snapshot");
+        return -1;
+    }
+    fprintf(stderr, "%s: kept the invalid snapshot as %s, totals start over\n",
+            filename, kept);
+    return -1;
+}
+
+static void typed_key_name(int index, char name[8]) {
+    if (index == TYPED_KEY_OTHER)
+        strcpy(name, "other");
+    else if (index == key_index(' '))
+        strcpy(name, "space");
+    else
+        snprintf(name, 8, "%c", FIRST_KEY + index);
+}
+
+// The most frequent wrong keys, straight from the confusion matrix
+static void print_mistypes(const stats *s) {
+    char shown[NUM_TYPED_KEYS][NUM_TYPED_KEYS] = {{0}};
+    for (int n = 0; n < MISTYPES_SHOWN; n++) {
+        int best_e = -1;
+        int best_t = -1;
+        for (int e = 0; e < NUM_TYPED_KEYS; e++) {
+            for (int t = 0; t < NUM_TYPED_KEYS; t++) {
+                if (e == t || shown[e][t] || s->confusion[e][t] == 0)
+                    continue;
+                if (best_e < 0 ||
+                    s->confusion[e][t] > s->confusion[best_e][best_t]) {
+                    best_e = e;
+                    best_t = t;
+                }
+            }
+        }
+        if (best_e < 0)
+            return;
+        if (n == 0)
+            printf("==== MOST MISTYPED ====\n");
+        shown[best_e][best_t] = 1;
+        char expected[8];
+        char typed[8];
+        typed_key_name(best_e, expected);
+        typed_key_name(best_t, typed);
+        printf("'%s' typed as '%s': %d times\n", expected, typed,
+               s->confusion[best_e][best_t]);
+    }
+}
+
+// Percentiles of the time taken per key, left out for keys typed before
+// histograms were kept
+static void print_latency(const latency_hist *h) {
+    if (latency_percentile(h, 50.0) <= 0.0)
+        return;
+    printf(", p50=%.0fms, p95=%.0fms, p99=%.0fms",
+           latency_percentile(h, 50.0) * 1000.0,
+           latency_percentile(h, 95.0) * 1000.0,
+           latency_percentile(h, 99.0) * 1000.0);
+}
+
 void print_stats(const stats *s) {
     // Print total stats
     double total_acc =
@@ -247,13 +702,26 @@ void print_stats(const stats *s) {
     for (int i = 0; i < NUM_KEYS; i++) {
         const key_stats *k = &s->per_key[i];
         if (k->pressed > 0) { // only print used keys
-            char key_char = 'a' + i;
             double acc = calc_acc(k->pressed, k->correct);
             double wpm = calc_wpm(k->pressed, k->time_spent);
 
-            printf("Key '%c': accuracy=%.2f%%, WPM=%.2f\n", key_char, acc, wpm);
+            printf("Key '%c': accuracy=%.2f%%, WPM=%.2f", k->key, acc, wpm);
+            print_latency(&k->latency);
+            printf("\n");
         }
     }
+    for (int i = 0; i < NUM_WIDE_KEYS; i++) {
+        const wide_key_stats *w = &s->wide_keys[i];
+        if (w->codepoint == 0 || w->pressed == 0)
+            continue;
+        char key[UTF8_MAX_BYTES];
+        int n = utf8_encode(w->codepoint, key);
+        double acc = calc_acc(w->pressed, w->correct);
+        double wpm = calc_wpm(w->pressed, w->time_spent);
+        printf("Key '%.*s': accuracy=%.2f%%, WPM=%.2f\n", n, key, acc, wpm);
+    }
+
+    print_mistypes(s);
 }
 
 double calc_wpm(int total_chars, double total_time) {
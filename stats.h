@@ -1,18 +1,61 @@
 #pragma once
+#include <stdint.h>
 
-#define NUM_KEYS 26 // a-z
+#include "events.h"
+#include "latency.h"
+
+struct aggregate;
+struct arena;
+
+// Printable ASCII is indexed directly by key - FIRST_KEY
+#define FIRST_KEY ' '
+#define NUM_KEYS 95           // ' ' to '~'
+#define NUM_TYPED_KEYS 96     // printable ASCII and anything else
+#define TYPED_KEY_OTHER 95    // index of keys that are not printable ASCII
+#define NUM_WIDE_KEYS 64      // codepoints past ASCII, a power of two
+#define WIDE_KEY_MAX_PROBES 8 // slots tried before a codepoint is dropped
+#define KEY_PRESS_BLOCK 64    // presses in one block of key history
+
+// One press of a key
+typedef struct {
+    double wpm;
+    char prev_key; // '\0' if none
+    char correct;
+} key_press;
+
+// Key history is kept in blocks chained in the order they were typed
+typedef struct key_press_block {
+    struct key_press_block *next;
+    int len;
+    key_press presses[KEY_PRESS_BLOCK];
+} key_press_block;
 
 typedef struct {
     char key;
     int pressed;
     int correct;
     double time_spent;
-    double *wpm_history;
-    int *acc_history;
-    char *prev_key_history;
-    int history_len;
+    latency_hist latency;
+    key_press_block *history; // NULL until the first press
+    key_press_block *history_tail;
+    int history_len; // presses in history
 } key_stats;
 
+// Presses of a key right after another key
+typedef struct {
+    int pressed;
+    int correct;
+    double time_spent;
+} digraph_stats;
+
+// A key past ASCII, in an open-addressed table keyed by codepoint
+typedef struct {
+    uint32_t codepoint; // 0 if the slot is free
+    int pressed;
+    int correct;
+    double time_spent;
+} wide_key_stats;
+
 typedef struct {
     int games_played;
     int total_keystrokes;
@@ -24,12 +67,33 @@ typedef struct {
 typedef struct {
     total_stats total;
     key_stats per_key[NUM_KEYS];
+    digraph_stats digraph[NUM_KEYS][NUM_KEYS];     // [prev key][key]
+    int confusion[NUM_TYPED_KEYS][NUM_TYPED_KEYS]; // [expected][typed]
+    wide_key_stats wide_keys[NUM_WIDE_KEYS];
+    struct arena *arena; // key history comes from here, none is kept if NULL
 } stats;
 
 void init_stats(stats *s);
 
-void update_key_stats(stats *s, char key_char, int correct, double time_taken,
-                      char prev_key);
+// Forget the key history, its memory belongs to the arena
+void free_stats(stats *s);
+
+// Index of a printable ASCII key in per_key, -1 for any other codepoint
+int key_index(uint32_t key);
+
+// Count a correctly typed key, a codepoint, prev_key being the one before it
+// or '\0' at the start
+void update_key_stats(stats *s, uint32_t key, int correct, int64_t time_ns,
+                      uint32_t prev_key);
+
+// Count a keystroke, right or wrong, in the confusion matrix
+void update_confusion(stats *s, uint32_t expected, uint32_t typed);
+
+// Index of a key in the confusion matrix
+int typed_key_index(uint32_t key);
+
+// Returns the slot of a codepoint past ASCII, or NULL if it has none
+const wide_key_stats *find_wide_key(const stats *s, uint32_t codepoint);
 
 void update_total_stats(stats *stats, int total_keystrokes,
                         int correct_keystrokes, double time, double wpm);
@@ -40,12 +104,47 @@ double get_key_wpm(key_stats *k);
 
 double get_key_accuracy(key_stats *k);
 
-void save_game_history(const char *player_name, stats *s);
+// Append the game played at date (unix time) to the key history, its rollup
+// tiers and the game summary
+void save_game_history(const char *player_name, int64_t date, stats *s);
+
+// Drop keystrokes older than keep_days days from the key history, keeping
+// them in the rollup tiers
+// Returns number of dropped keystrokes, -1 on failure
+long compact_key_history(const char *player_name, int keep_days);
+
+// Returns 1 if stats/<player>.aggregate.bin was loaded, 0 otherwise
+int load_aggregate(const char *player_name, struct aggregate *a);
+
+// Fold this game's keystrokes into stats/<player>.aggregate.bin, building it
+// from the key history first if it does not exist yet
+void save_aggregate(const char *player_name, stats *s);
+
+// Append every keystroke of the game played at date to stats/<player>.events
+void save_game_events(const char *player_name, int64_t date, uint32_t seed,
+                      const char *text, const event_log *log);
+
+// Write stats/<player>.key-history.export.csv from the binary key history
+// Returns number of exported rows, -1 on failure
+int export_key_history(const char *player_name);
 
 void save_stats(const char *player_name, stats *s);
 
+// Save the stats of n players, writing all of them before syncing any so the
+// disk sees one batch
+// Returns 0 on success, -1 if any of them failed
+int save_stats_batch(const char *const *player_names, stats *const *s,
+                     int n);
+
+// Returns 1 if loaded, 0 if the player has no stats, -1 if the snapshot is
+// invalid: it is kept as <snapshot>.corrupt and the totals start over
 int load_stats(const char *player_name, stats *s);
 
+// Print the top players from stats/leaderboard.bin, and the ranks of
+// player_name unless it is NULL
+// Returns 0 on success, -1 if there is no leaderboard
+int print_leaderboard(const char *player_name);
+
 void print_stats(const stats *s);
 
 double calc_wpm(int total_chars, double total_time);
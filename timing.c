@@ -0,0 +1,11 @@
+#include <time.h>
+
+#include "timing.h"
+
+int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+double ns_to_sec(int64_t ns) { return (double)ns / NS_PER_SEC; }
@@ -0,0 +1,9 @@
+#pragma once
+#include <stdint.h>
+
+#define NS_PER_SEC 1000000000LL
+
+// Nanoseconds on the monotonic clock, unaffected by wall clock changes
+int64_t now_ns(void);
+
+double ns_to_sec(int64_t ns);
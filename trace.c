@@ -0,0 +1,124 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+typedef struct {
+    int64_t start_ns;
+    int64_t end_ns;
+    uint32_t phase;
+    uint32_t thread;
+    uint32_t arg;
+} trace_event;
+
+typedef struct {
+    const char *name;
+    const char *category;
+    const char *arg_name; // NULL if the phase has no argument
+} phase_info;
+
+static const phase_info phases[NUM_TRACE_PHASES] = {
+    [TRACE_LOAD_WORDS] = {"load words", "setup", "words"},
+    [TRACE_BUILD_TEXT] = {"build text", "setup", "lines"},
+    [TRACE_INPUT] = {"input", "key", "key"},
+    [TRACE_KEYSTROKE] = {"keystroke", "key", "key"},
+    [TRACE_UPDATE] = {"update", "key", "key"},
+    [TRACE_RENDER] = {"render", "key", NULL},
+    [TRACE_HUD] = {"hud", "tick", NULL},
+    [TRACE_GHOST] = {"ghost", "tick", NULL},
+    [TRACE_SAVE_HISTORY] = {"save history", "save", NULL},
+    [TRACE_SAVE_EVENTS] = {"save events", "save", NULL},
+    [TRACE_SAVE_AGGREGATE] = {"save aggregate", "save", NULL},
+    [TRACE_SAVE_TOTALS] = {"save totals", "save", NULL},
+};
+
+int trace_on = 0;
+
+static const char *trace_filename;
+static trace_event *ring;
+static atomic_uint_fast64_t num_spans; // ever recorded, wraps the ring
+static atomic_uint next_thread = 1;
+static _Thread_local uint32_t thread_id; // 0 until the thread's first span
+static int64_t trace_start_ns;
+
+int trace_open(const char *filename) {
+    ring = calloc(TRACE_CAPACITY, sizeof(trace_event));
+    if (!ring) {
+        perror("calloc failed");
+        return -1;
+    }
+    trace_filename = filename;
+    atomic_store(&num_spans, 0);
+    trace_start_ns = now_ns();
+    trace_on = 1;
+    return 0;
+}
+
+void trace_span(trace_phase phase, int64_t start_ns, int64_t end_ns,
+                uint32_t arg) {
+    if (thread_id == 0)
+        thread_id = atomic_fetch_add(&next_thread, 1);
+    uint64_t n = atomic_fetch_add(&num_spans, 1);
+    trace_event *e = &ring[n % TRACE_CAPACITY];
+    e->start_ns = start_ns;
+    e->end_ns = end_ns;
+    e->phase = phase;
+    e->thread = thread_id;
+    e->arg = arg;
+}
+
+// Microseconds since tracing started, the unit of trace-event JSON
+static double trace_us(int64_t ns) { return (ns - trace_start_ns) / 1e3; }
+
+int trace_close(void) {
+    if (!trace_on)
+        return 0;
+    trace_on = 0;
+
+    FILE *f = fopen(trace_filename, "w");
+    if (!f) {
+        perror("Could not open trace file");
+        free(ring);
+        ring = NULL;
+        return -1;
+    }
+
+    // Only the newest TRACE_CAPACITY spans are left, oldest first
+    uint64_t total = atomic_load(&num_spans);
+    uint64_t first = total > TRACE_CAPACITY ? total - TRACE_CAPACITY : 0;
+    int pid = getpid();
+    fprintf(f, "{\"traceEvents\":[\n");
+    fprintf(f,
+            "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+            "\"args\":{\"name\":\"neotap\"}}",
+            pid);
+    for (uint64_t n = first; n < total; n++) {
+        const trace_event *e = &ring[n % TRACE_CAPACITY];
+        const phase_info *p = &phases[e->phase];
+        fprintf(f,
+                ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+                "\"pid\":%d,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f",
+                p->name, p->category, pid, e->thread, trace_us(e->start_ns),
+                (e->end_ns - e->start_ns) / 1e3);
+        if (p->arg_name)
+            fprintf(f, ",\"args\":{\"%s\":%u}", p->arg_name, e->arg);
+        fputc('}', f);
+    }
+    fprintf(f, "\n],\"displayTimeUnit\":\"ns\"}\n");
+
+    int ret = 0;
+    if (ferror(f)) {
+        perror("Could not write trace file");
+        ret = -1;
+    }
+    if (fclose(f) != 0)
+        ret = -1;
+    free(ring);
+    ring = NULL;
+    if (total > TRACE_CAPACITY)
+        fprintf(stderr, "Trace kept the last %d of %llu spans\n",
+                TRACE_CAPACITY, (unsigned long long)total);
+    return ret;
+}
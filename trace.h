@@ -0,0 +1,54 @@
+#pragma once
+#include <stdint.h>
+
+#include "timing.h"
+
+// Phase tracing for --trace: timed spans are recorded into a ring buffer
+// allocated up front and written out at exit as Chrome trace-event JSON, which
+// chrome://tracing and Perfetto open. While tracing is off a span costs a
+// load and a branch.
+
+#define TRACE_CAPACITY 65536 // spans kept, the oldest are overwritten
+
+typedef enum {
+    TRACE_LOAD_WORDS,
+    TRACE_BUILD_TEXT,
+    TRACE_INPUT,     // reading a key from the terminal
+    TRACE_KEYSTROKE, // from the key being read until its frame is out
+    TRACE_UPDATE,    // game and journal
+    TRACE_RENDER,
+    TRACE_HUD,
+    TRACE_GHOST,
+    TRACE_SAVE_HISTORY,
+    TRACE_SAVE_EVENTS,
+    TRACE_SAVE_AGGREGATE,
+    TRACE_SAVE_TOTALS,
+    NUM_TRACE_PHASES,
+} trace_phase;
+
+extern int trace_on;
+
+// Start tracing into a buffer of TRACE_CAPACITY spans, written to filename
+// by trace_close()
+// Returns 0 on success, -1 on failure
+int trace_open(const char *filename);
+
+// Record a span from start_ns to end_ns, arg is shown with it if the phase
+// has one (the key of keystroke phases)
+void trace_span(trace_phase phase, int64_t start_ns, int64_t end_ns,
+                uint32_t arg);
+
+// Start of a span, 0 while tracing is off
+static inline int64_t trace_begin(void) { return trace_on ? now_ns() : 0; }
+
+// End a span started with trace_begin()
+static inline void trace_end(trace_phase phase, int64_t start_ns,
+                             uint32_t arg) {
+    if (trace_on)
+        trace_span(phase, start_ns, now_ns(), arg);
+}
+
+// Write the recorded spans and stop tracing; spans recorded by other threads
+// must have finished
+// Returns 0 on success or if tracing is off, -1 on failure
+int trace_close(void);
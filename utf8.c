@@ -0,0 +1,127 @@
+#include "utf8.h"
+
+typedef struct {
+    uint32_t first;
+    uint32_t last;
+} cp_range;
+
+// The common combining marks, not the full Unicode tables
+static const cp_range zero_width[] = {
+    {0x0300, 0x036f}, {0x0483, 0x0489}, {0x0591, 0x05bd}, {0x0610, 0x061a},
+    {0x064b, 0x065f}, {0x0e31, 0x0e31}, {0x0e34, 0x0e3a}, {0x200b, 0x200f},
+    {0x20d0, 0x20ff}, {0xfe00, 0xfe0f}, {0xfe20, 0xfe2f},
+};
+
+static const cp_range wide[] = {
+    {0x1100, 0x115f},   {0x2e80, 0x303e},   {0x3041, 0x33ff},
+    {0x3400, 0x4dbf},   {0x4e00, 0x9fff},   {0xa000, 0xa4cf},
+    {0xac00, 0xd7a3},   {0xf900, 0xfaff},   {0xfe30, 0xfe4f},
+    {0xff00, 0xff60},   {0xffe0, 0xffe6},   {0x1f300, 0x1f64f},
+    {0x1f900, 0x1f9ff}, {0x20000, 0x2fffd}, {0x30000, 0x3fffd},
+};
+
+static int in_ranges(uint32_t cp, const cp_range *r, int n) {
+    for (int i = 0; i < n; i++) {
+        if (cp >= r[i].first && cp <= r[i].last)
+            return 1;
+    }
+    return 0;
+}
+
+int utf8_is_cont(unsigned char c) { return (c & 0xc0) == 0x80; }
+
+int utf8_seq_len(unsigned char c) {
+    if (c >= 0xc2 && c <= 0xdf)
+        return 2;
+    if (c >= 0xe0 && c <= 0xef)
+        return 3;
+    if (c >= 0xf0 && c <= 0xf4)
+        return 4;
+    return 1;
+}
+
+int utf8_decode(const char *s, int n, uint32_t *cp) {
+    const unsigned char *u = (const unsigned char *)s;
+    int len = utf8_seq_len(u[0]);
+    if (len == 1) {
+        *cp = u[0] < 0x80 ? u[0] : UTF8_INVALID;
+        return 1;
+    }
+    if (len > n) {
+        *cp = UTF8_INVALID;
+        return 1;
+    }
+
+    uint32_t c = u[0] & (0x7f >> len);
+    for (int i = 1; i < len; i++) {
+        if (!utf8_is_cont(u[i])) {
+            *cp = UTF8_INVALID;
+            return 1;
+        }
+        c = c << 6 | (u[i] & 0x3f);
+    }
+
+    // Overlong forms, surrogates and anything past U+10FFFF
+    static const uint32_t min_cp[UTF8_MAX_BYTES + 1] = {0, 0, 0x80, 0x800,
+                                                        0x10000};
+    if (c < min_cp[len] || (c >= 0xd800 && c <= 0xdfff) || c > 0x10ffff) {
+        *cp = UTF8_INVALID;
+        return 1;
+    }
+    *cp = c;
+    return len;
+}
+
+int utf8_encode(uint32_t cp, char out[UTF8_MAX_BYTES]) {
+    if (cp < 0x80) {
+        out[0] = cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        out[0] = 0xc0 | cp >> 6;
+        out[1] = 0x80 | (cp & 0x3f);
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = 0xe0 | cp >> 12;
+        out[1] = 0x80 | (cp >> 6 & 0x3f);
+        out[2] = 0x80 | (cp & 0x3f);
+        return 3;
+    }
+    out[0] = 0xf0 | cp >> 18;
+    out[1] = 0x80 | (cp >> 12 & 0x3f);
+    out[2] = 0x80 | (cp >> 6 & 0x3f);
+    out[3] = 0x80 | (cp & 0x3f);
+    return 4;
+}
+
+int utf8_width(uint32_t cp) {
+    if (cp < 0x300)
+        return 1;
+    if (in_ranges(cp, zero_width, sizeof(zero_width) / sizeof(*zero_width)))
+        return 0;
+    if (in_ranges(cp, wide, sizeof(wide) / sizeof(*wide)))
+        return 2;
+    return 1;
+}
+
+int utf8_text_width(const char *s, int n) {
+    int cols;
+    utf8_fit(s, n, n * 2, &cols);
+    return cols;
+}
+
+int utf8_fit(const char *s, int n, int max_cols, int *cols) {
+    int i = 0;
+    *cols = 0;
+    while (i < n) {
+        uint32_t cp;
+        int len = utf8_decode(s + i, n - i, &cp);
+        int w = cp == UTF8_INVALID ? 1 : utf8_width(cp);
+        if (*cols + w > max_cols)
+            break;
+        *cols += w;
+        i += len;
+    }
+    return i;
+}
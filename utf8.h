@@ -0,0 +1,30 @@
+#pragma once
+#include <stdint.h>
+
+#define UTF8_MAX_BYTES 4
+#define UTF8_INVALID 0xffffffffu // decoded from a malformed sequence
+
+// Whether c continues a multi-byte sequence rather than starting a char
+int utf8_is_cont(unsigned char c);
+
+// Length of the sequence a lead byte starts, 1 if it cannot start one
+int utf8_seq_len(unsigned char c);
+
+// Decode the char at the start of s, reading at most n bytes
+// Returns the bytes it takes, at least 1 so malformed input is skipped a
+// byte at a time, and sets *cp to UTF8_INVALID if it is malformed
+int utf8_decode(const char *s, int n, uint32_t *cp);
+
+// Returns the number of bytes written to out
+int utf8_encode(uint32_t cp, char out[UTF8_MAX_BYTES]);
+
+// Terminal columns of a codepoint: 0 for combining marks, 2 for wide East
+// Asian chars and emoji, 1 otherwise
+int utf8_width(uint32_t cp);
+
+// Columns taken by the first n bytes of s
+int utf8_text_width(const char *s, int n);
+
+// Bytes of the longest prefix of the first n bytes of s that fits in max_cols
+// columns, its width in *cols
+int utf8_fit(const char *s, int n, int max_cols, int *cols);
@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "window.h"
+
+// Copy the WINDOW_LINES lines from start into shown
+static int fill(text_window *w) {
+    const char *first = w->text + w->start;
+    const char *end = first;
+    for (int line = 0; line < WINDOW_LINES && *end; line++) {
+        const char *nl = strchr(end, '\n');
+        end = nl ? nl + 1 : end + strlen(end);
+    }
+
+    size_t len = end - first;
+    if (len + 1 > w->shown_cap) {
+        char *shown = realloc(w->shown, len + 1);
+        if (!shown) {
+            perror("realloc failed");
+            return -1;
+        }
+        w->shown = shown;
+        w->shown_cap = len + 1;
+    }
+    memcpy(w->shown, first, len);
+    w->shown[len] = '\0';
+    w->shown_len = len;
+    return 0;
+}
+
+int window_set_text(text_window *w, const char *text, int idx) {
+    w->text = text;
+    w->text_len = strlen(text);
+    w->start = idx;
+    while (w->start > 0 && text[w->start - 1] != '\n')
+        w->start--;
+    return fill(w);
+}
+
+int window_follow(text_window *w, int idx) {
+    int moved = 0;
+    while (w->start + w->shown_len < w->text_len) {
+        const char *nl = strchr(w->text + w->start, '\n');
+        if (!nl || idx <= nl - w->text)
+            break;
+        w->start = nl - w->text + 1;
+        moved = 1;
+    }
+    if (moved && fill(w) != 0)
+        return -1;
+    return moved;
+}
+
+int window_index(const text_window *w, int idx) {
+    if (idx < w->start || idx > w->start + w->shown_len)
+        return -1;
+    return idx - w->start;
+}
+
+int window_rows(const text_window *w) {
+    int rows = 1;
+    for (int i = 0; i < w->shown_len; i++)
+        rows += w->shown[i] == '\n';
+    return rows;
+}
+
+void window_free(text_window *w) {
+    free(w->shown);
+    memset(w, 0, sizeof(*w));
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <stddef.h>
+
+#include "passage.h"
+
+// Word tests keep their whole text for the game, the journal and the event
+// log, but like passages only show a window of its next lines, so that a long
+// or timed test fits the terminal. The window starts at the line being typed
+// and moves down a line once it has been typed.
+
+#define WINDOW_LINES PASSAGE_LINES
+
+typedef struct {
+    const char *text; // whole test text
+    int text_len;
+    int start; // index in text of the first line shown
+    char *shown; // the lines shown, each ending in its "\n" if it has one
+    int shown_len;
+    size_t shown_cap;
+} text_window;
+
+// Show the lines of text from the one that holds idx, e.g. after the text was
+// wrapped again
+// Returns 0 on success, -1 on failure
+int window_set_text(text_window *w, const char *text, int idx);
+
+// Move the window down while idx is past its first line and there are lines
+// after it
+// Returns 1 if it moved, 0 if not, -1 on failure
+int window_follow(text_window *w, int idx);
+
+// Index in the shown lines of an index in the text, -1 if it is not shown
+int window_index(const text_window *w, int idx);
+
+// Rows the shown lines take when printed, the line after a final "\n"
+// included
+int window_rows(const text_window *w);
+
+void window_free(text_window *w);